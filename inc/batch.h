@@ -0,0 +1,14 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include <ctx.h>
+
+// the budget, form, engine, jit and optimizations of settings apply to
+// every term
+int batch(FILE *in, int workers, struct ctx *settings);
+
+#endif
@@ -0,0 +1,31 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// binary snapshots of object graphs, every object is written once and
+// referenced by its index afterwards, so the sharing is preserved
+// errors are sticky and reported by checkpoint_close
+struct checkpoint;
+
+struct checkpoint *checkpoint_writer(FILE *file);
+struct checkpoint *checkpoint_reader(FILE *file);
+void checkpoint_fail(struct checkpoint *checkpoint);
+int checkpoint_failed(struct checkpoint *checkpoint);
+int checkpoint_close(struct checkpoint *checkpoint);
+
+// unsigned integers, encoded with variable length
+void checkpoint_write(struct checkpoint *checkpoint, uint64_t value);
+uint64_t checkpoint_read(struct checkpoint *checkpoint);
+
+// returns 1 if the object is new and its fields have to be written next
+int checkpoint_write_ref(struct checkpoint *checkpoint, const void *object);
+// returns 1 if the object is new, it has to be defined before its fields
+// are read, otherwise *object is set to the known object or 0
+int checkpoint_read_ref(struct checkpoint *checkpoint, void **object);
+void checkpoint_define(struct checkpoint *checkpoint, void *object);
+
+#endif
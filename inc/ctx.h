@@ -0,0 +1,101 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef CTX_H
+#define CTX_H
+
+#include <stddef.h>
+
+struct pool;
+struct remote;
+struct store;
+
+// limits of a single reduction, 0 means unlimited
+struct budget {
+	size_t transitions;
+	size_t allocated; // bytes allocated by the reducer
+	size_t heap; // bytes of the garbage collected heap
+	size_t output; // nodes of the normal form
+	double time; // seconds of wall-clock time
+};
+
+typedef enum {
+	WITHIN_BUDGET,
+	TRANSITIONS_EXCEEDED,
+	ALLOCATED_EXCEEDED,
+	HEAP_EXCEEDED,
+	OUTPUT_EXCEEDED,
+	TIME_EXCEEDED,
+	CANCELLED, // by reduce_finish
+} budget_state;
+
+typedef enum {
+	NORMAL_FORM,
+	HEAD_NORMAL_FORM, // the arguments of the head stay suspended
+	WEAK_HEAD_NORMAL_FORM, // bodies of abstractions as well
+} reduction_form;
+
+typedef enum {
+	RKNL, // strong call-by-need, see reducer.c
+	FIREBALL, // strong call-by-value, see fireball.c
+	CRUMBLING, // crumbled call-by-value, see crumble.c
+	INTERACTION, // optimal reduction of sharing graphs, see net.c
+	BYTECODE, // lazy krivine machine on compiled terms, see vm.c
+	SUPERCOMBINATOR, // lambda lifted graph reduction, see lift.c
+} reduction_engine;
+
+// additional transitions of RKNL, their sequences differ from tests/*.trans
+typedef enum {
+	NARY_BETA = 1 << 0, // (6) and (12) bind all available arguments at once
+	FUSED = 1 << 1, // (12), (13) and (14) for frequent sequences
+	ATOMIC = 1 << 2, // (6) and (12) don't suspend variables and abstractions
+	TRIM = 1 << 3, // abstractions only keep the bindings of free variables
+	LINEAR = 1 << 4, // (15) doesn't update boxes of binders used once
+} reduction_optimization;
+
+// per-instance state of the reducer, so independent reductions can run on
+// different threads -- a context itself may only be used by one thread
+struct ctx {
+	int name; // next fresh variable name
+	struct ctx *parent; // child contexts share the name supply of the root
+	struct pool *pool; // strong reduction of subterms in parallel if set
+	// budget of speculative box evaluations, needs pool -- the normal form
+	// stays the same, but the transitions don't: a box that a speculation
+	// finished is taken with (4) instead of being evaluated by (3)
+	// INTERACTION reduces as many active pairs ahead of the read back
+	size_t speculate;
+	struct remote *remote; // worker processes for the subterms, needs pool
+	reduction_form form; // of the results of reduce
+	reduction_engine engine; // of reduce, the others only support RKNL
+	size_t jit; // applications of a body until BYTECODE compiles it, or 0
+	unsigned optimize; // set of reduction_optimization
+	struct store *free_vars; // of terms in a reduction with TRIM, see reducer.c
+	struct budget budget;
+	struct budget limit; // absolute values of the budget in this reduction
+	budget_state exceeded; // reduce returned 0 because of this limit
+	size_t fuel; // transitions until the limits are checked again
+	void *(*alloc)(size_t size);
+	struct {
+		size_t transitions;
+		size_t allocations;
+		size_t allocated; // bytes
+		size_t speculated; // boxes or pairs reduced ahead of demand
+		size_t shipped; // subterms normalized by worker processes
+		size_t compiled; // abstraction bodies compiled to native code
+		size_t lookups; // of variables by (3) and (4)
+		size_t probed; // lookups answered by a box probed before
+		size_t output; // nodes of normal forms
+	} stats;
+};
+
+void ctx_init(struct ctx *ctx);
+void ctx_child(struct ctx *ctx, struct ctx *parent);
+void ctx_merge(struct ctx *ctx);
+void ctx_start(struct ctx *ctx);
+int ctx_check(struct ctx *ctx);
+int ctx_exceeded(struct ctx *ctx);
+int ctx_name(struct ctx *ctx);
+void *ctx_alloc(struct ctx *ctx, size_t size);
+void *xrealloc(void *ptr, size_t size);
+void *xcalloc(size_t count, size_t size);
+
+#endif
@@ -0,0 +1,12 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef FIREBALL_H
+#define FIREBALL_H
+
+#include <ctx.h>
+#include <term.h>
+
+struct term *fireball(struct ctx *ctx, struct term *term,
+		      void (*callback)(int, char, void *), void *data);
+
+#endif
@@ -0,0 +1,28 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef LAZY_H
+#define LAZY_H
+
+#include <stddef.h>
+
+#include <ctx.h>
+#include <term.h>
+
+// normal forms that are only reduced where they are inspected: every node
+// is either an abstraction or a variable applied to arguments, inspecting
+// it reduces it to weak head normal form, the rest stays suspended
+// inspections return 0 or INV if the budget of ctx is exceeded
+// handles are allocated by the collector and never freed explicitly, keep
+// them where it can see them (stack, registers or collected memory) -- a
+// handle only referenced from malloc'd memory may be collected under you
+struct lazy;
+
+struct lazy *lazy_new(struct ctx *ctx, struct term *term);
+term_type lazy_type(struct lazy *lazy); // ABS or VAR
+int lazy_name(struct lazy *lazy); // of the abstraction or head variable
+size_t lazy_arity(struct lazy *lazy);
+struct lazy *lazy_argument(struct lazy *lazy, size_t i);
+struct lazy *lazy_body(struct lazy *lazy);
+struct term *lazy_normalize(struct lazy *lazy); // the complete normal form
+
+#endif
@@ -0,0 +1,12 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef NET_H
+#define NET_H
+
+#include <ctx.h>
+#include <term.h>
+
+struct term *net(struct ctx *ctx, struct term *term,
+		 void (*callback)(int, char, void *), void *data);
+
+#endif
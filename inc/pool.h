@@ -0,0 +1,19 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// fixed number of worker threads, each with its own deque of tasks
+// idle workers steal the oldest tasks of the others
+struct pool;
+
+struct pool *pool_new(int workers);
+void pool_submit(struct pool *pool, void (*run)(void *), void *data);
+void pool_wait(struct pool *pool);
+size_t pool_pending(struct pool *pool);
+int pool_workers(struct pool *pool);
+void pool_destroy(struct pool *pool);
+
+#endif
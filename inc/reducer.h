@@ -3,9 +3,30 @@
 #ifndef REDUCER_H
 #define REDUCER_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #include <term.h>
+#include <ctx.h>
+
+// subterms of head normal forms are suspended as CLOSURE terms, reducing
+// them continues in their environment, using the same ctx
+struct term *reduce(struct ctx *ctx, struct term *term,
+		    void (*callback)(int, char, void *), void *data);
+
+// step-wise reduction, a context may only host one reduction at a time
+struct reduction;
+
+struct reduction *reduce_start(struct ctx *ctx, struct term *term,
+			       void (*callback)(int, char, void *),
+			       void *data);
+int reduce_run(struct reduction *reduction, size_t steps);
+struct term *reduce_finish(struct reduction *reduction);
 
-struct term *reduce(struct term *term, void (*callback)(int, char, void *),
-		    void *data);
+// binary snapshots of sequential reductions, see checkpoint.h
+int reduce_checkpoint(struct reduction *reduction, FILE *file);
+struct reduction *reduce_restore(struct ctx *ctx, FILE *file,
+				 void (*callback)(int, char, void *),
+				 void *data);
 
 #endif
@@ -0,0 +1,32 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stddef.h>
+
+#include <ctx.h>
+#include <term.h>
+
+// normalization tasks are sent to other calm processes as closed BLC terms,
+// one per line, and their normal forms are sent back the same way
+// addresses are paths of unix sockets or <host>:<port> for tcp
+struct remote;
+
+struct remote *remote_connect(const char *addresses); // separated by ','
+int remote_acquire(struct remote *remote);
+char *remote_call(struct remote *remote, int connection, const char *task);
+void remote_release(struct remote *remote, int connection);
+int remote_connections(struct remote *remote);
+void remote_disconnect(struct remote *remote);
+
+int remote_listen(const char *address);
+int remote_serve(int fd, int parallel);
+
+// conversions of terms without depth limit, parsing returns the body below
+// the first count abstractions, which bind names, the others get fresh names
+char *remote_blc(struct term *term);
+struct term *remote_term(struct ctx *ctx, const char *blc, const int *names,
+			 size_t count);
+
+#endif
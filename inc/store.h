@@ -62,6 +62,11 @@
 	(STORE_KEY_T key, STORE_VALUE_T old_value, void *user_data)
 #define STORE_VALUE_EQUALSFN_T(name)                                           \
 	int (*name)(STORE_VALUE_T left, STORE_VALUE_T right)
+#define STORE_WRITEFN_T(name)                                                  \
+	void (*name)(STORE_KEY_T key, STORE_VALUE_T value, void *user_data)
+#define STORE_READFN_T(name)                                                   \
+	void (*name)(STORE_KEY_T * key_receiver,                               \
+		     STORE_VALUE_T * value_receiver, void *user_data)
 
 /**
  * These macros help with defining the various callbacks. Use them like so:
@@ -176,6 +181,22 @@ struct store *store_set(const struct store *store, STORE_KEY_T key,
 struct store *store_of(STORE_HASHFN_T(hash), STORE_EQUALSFN_T(equals),
 		       STORE_KEY_T *keys, STORE_VALUE_T *values, size_t length);
 
+/**
+ * Returns a new map derived from store but with the given keys set to the given values, in order.
+ * Only the first 'length' elements from keys and values are inserted. The keys are sorted by their hashes and
+ * the new trie is built in one pass, copying every node on their paths only once.
+ *
+ * Reference count of the new map is zero.
+ *
+ * @param store
+ * @param keys
+ * @param values
+ * @param length
+ * @return a new store
+ */
+struct store *store_set_all(const struct store *store, STORE_KEY_T *keys,
+			    STORE_VALUE_T *values, size_t length);
+
 /**
  * Returns a new map derived from store, but with key set to the return value of fn.
  * fn is passed the key, the current value for key, and user_data.
@@ -204,6 +225,32 @@ struct store *store_assoc(const struct store *store, STORE_KEY_T key,
 int store_equals(const struct store *left, const struct store *right,
 		 STORE_VALUE_EQUALSFN_T(value_equals));
 
+struct checkpoint;
+
+/**
+ * Writes store to a checkpoint. Nodes that are shared with stores written before are only referenced, so the
+ * sharing survives the checkpoint. Keys and values are written by write, which is passed user_data.
+ *
+ * @param store
+ * @param checkpoint
+ * @param write
+ * @param user_data
+ */
+void store_write(const struct store *store, struct checkpoint *checkpoint,
+		 STORE_WRITEFN_T(write), void *user_data);
+
+/**
+ * Reads the contents of a store written by store_write into store, which should be new. Keys and values are read
+ * by read, which is passed user_data.
+ *
+ * @param store
+ * @param checkpoint
+ * @param read
+ * @param user_data
+ */
+void store_read(struct store *store, struct checkpoint *checkpoint,
+		STORE_READFN_T(read), void *user_data);
+
 /**
  * An iterator for store. Meant to be put on the stack.
  */
@@ -3,13 +3,24 @@
 #ifndef TERM_H
 #define TERM_H
 
-typedef enum { INV, ABS, APP, VAR, CLOSURE, CACHE } term_type;
+#include <stdint.h>
+
+struct ctx;
+
+typedef enum { INV, ABS, APP, VAR, CLOSURE, CACHE, FUTURE } term_type;
 
 struct term {
 	term_type type;
+	uint32_t hash; // structural hash of bruijn form, 0 if not computed
 	union {
 		struct {
 			int name;
+			enum {
+				UNANALYZED,
+				UNUSED,
+				USED_ONCE,
+				SHARED,
+			} usage; // of the binder, see reducer.c
 			struct term *term;
 		} abs;
 		struct {
@@ -28,6 +39,10 @@ void to_barendregt(struct term *term);
 void to_bruijn(struct term *term);
 struct term *new_term(term_type type);
 struct term *duplicate_term(struct term *term);
+struct term *alloc_term(struct ctx *ctx, term_type type);
+struct term *output_term(struct ctx *ctx, term_type type);
+struct term *copy_term(struct ctx *ctx, struct term *term);
+uint32_t term_hash(struct term *term);
 int alpha_equivalency(struct term *a, struct term *b);
 void free_term(struct term *term);
 void print_term(struct term *term);
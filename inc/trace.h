@@ -0,0 +1,18 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// frequent sequences of transitions in traces of the reducer (as in
+// tests/*.trans), candidates for fused transitions
+struct trace;
+
+struct trace *trace_new(size_t length); // sequences of 2 up to length
+void trace_add(struct trace *trace, const char *transitions);
+void trace_print(struct trace *trace, FILE *out, size_t top); // per length
+void trace_free(struct trace *trace);
+
+#endif
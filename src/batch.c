@@ -0,0 +1,206 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// reduces many terms concurrently, results are written in input order
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <batch.h>
+#include <pool.h>
+#include <parse.h>
+#include <reducer.h>
+#include <gc.h>
+
+struct job {
+	struct batch *batch;
+	char *input;
+	struct term *res;
+	struct ctx ctx;
+	int done;
+};
+
+// in-flight jobs live in a window of slots, this bounds memory usage and
+// lets the reader and writer overlap with the reductions
+struct batch {
+	struct job **slots;
+	size_t window;
+	size_t read;
+	size_t written;
+	int eof;
+	size_t transitions;
+	size_t exceeded; // terms without result, printed as empty lines
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// one term per line, or "<length>:<term>" for terms spanning lines
+static char *read_term(FILE *in)
+{
+	size_t size = 64, length = 0;
+	char *line = xrealloc(0, size);
+	int ch;
+	while ((ch = fgetc(in)) != EOF && ch != '\n') {
+		if (length + 1 == size)
+			line = xrealloc(line, size *= 2);
+		line[length++] = ch;
+	}
+	line[length] = 0;
+	if (ch == EOF && !length) {
+		free(line);
+		return 0;
+	}
+
+	char *colon = strchr(line, ':');
+	if (!colon || colon == line)
+		return line;
+	for (char *digit = line; digit < colon; digit++)
+		if (!isdigit(*digit))
+			return line;
+
+	size_t expected = strtoul(line, 0, 10);
+	char *term = xrealloc(0, expected + 1);
+	size_t prefix = strlen(colon + 1);
+	if (prefix > expected)
+		prefix = expected;
+	memcpy(term, colon + 1, prefix);
+	if (prefix < expected) {
+		term[prefix++] = '\n'; // consumed by the line reader
+		prefix += fread(term + prefix, 1, expected - prefix, in);
+	}
+	term[prefix] = 0;
+	free(line);
+	return term;
+}
+
+static void callback(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
+static void run_job(void *data)
+{
+	struct job *job = data;
+	struct term *parsed = parse_blc(job->input);
+	job->res = reduce(&job->ctx, parsed, callback, 0);
+	if (job->res)
+		to_bruijn(job->res);
+	free_term(parsed);
+
+	struct batch *batch = job->batch;
+	pthread_mutex_lock(&batch->lock);
+	job->done = 1;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->lock);
+}
+
+static void *writer(void *data)
+{
+	struct batch *batch = data;
+	for (size_t i = 0;; i++) {
+		pthread_mutex_lock(&batch->lock);
+		while (!(i < batch->read &&
+			 batch->slots[i % batch->window]->done) &&
+		       !(batch->eof && i == batch->read))
+			pthread_cond_wait(&batch->cond, &batch->lock);
+		if (i == batch->read) {
+			pthread_mutex_unlock(&batch->lock);
+			break;
+		}
+		struct job *job = batch->slots[i % batch->window];
+		pthread_mutex_unlock(&batch->lock);
+
+		if (job->res) {
+			print_blc(job->res);
+			free_term(job->res);
+		} else {
+			batch->exceeded++;
+		}
+		printf("\n");
+		batch->transitions += job->ctx.stats.transitions;
+		free(job->input);
+		GC_free(job);
+
+		pthread_mutex_lock(&batch->lock);
+		batch->written++;
+		pthread_cond_broadcast(&batch->cond);
+		pthread_mutex_unlock(&batch->lock);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+int batch(FILE *in, int workers, struct ctx *settings)
+{
+	struct batch batch = { 0 };
+	batch.window = 64 * workers;
+	batch.slots = xrealloc(0, batch.window * sizeof(*batch.slots));
+	pthread_mutex_init(&batch.lock, 0);
+	pthread_cond_init(&batch.cond, 0);
+
+	struct pool *pool = pool_new(workers);
+	pthread_t thread;
+	if (pthread_create(&thread, 0, writer, &batch)) {
+		fprintf(stderr, "Can't create writer thread\n");
+		return 1;
+	}
+
+	clock_t begin = clock();
+	char *input;
+	while ((input = read_term(in))) {
+		if (!strpbrk(input, "01")) {
+			free(input);
+			continue;
+		}
+
+		// uncollectable as the slots are invisible to the collector,
+		// the result is only referenced by the job until it's written
+		struct job *job = GC_malloc_uncollectable(sizeof(*job));
+		if (!job) {
+			fprintf(stderr, "Out of memory!\n");
+			abort();
+		}
+		job->batch = &batch;
+		job->input = input;
+		job->res = 0;
+		job->done = 0;
+		ctx_init(&job->ctx);
+		job->ctx.budget = settings->budget;
+		job->ctx.form = settings->form;
+		job->ctx.engine = settings->engine;
+		job->ctx.jit = settings->jit;
+		job->ctx.optimize = settings->optimize;
+
+		pthread_mutex_lock(&batch.lock);
+		while (batch.read - batch.written >= batch.window)
+			pthread_cond_wait(&batch.cond, &batch.lock);
+		batch.slots[batch.read++ % batch.window] = job;
+		pthread_mutex_unlock(&batch.lock);
+
+		pool_submit(pool, run_job, job);
+	}
+
+	pthread_mutex_lock(&batch.lock);
+	batch.eof = 1;
+	pthread_cond_broadcast(&batch.cond);
+	pthread_mutex_unlock(&batch.lock);
+
+	pthread_join(thread, 0);
+	pool_destroy(pool);
+	clock_t end = clock();
+	fprintf(stderr, "reduced %zu terms in %.5fs cpu (%zu transitions)\n",
+		batch.read, (double)(end - begin) / CLOCKS_PER_SEC,
+		batch.transitions);
+	if (batch.exceeded)
+		fprintf(stderr, "%zu terms exceeded the budget\n",
+			batch.exceeded);
+
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.cond);
+	free(batch.slots);
+	return ferror(in) ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// see reducer.c for the snapshots of the machine
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <checkpoint.h>
+#include <ctx.h>
+#include <gc.h>
+
+#define MAGIC "calm\x02"
+#define TRAILER "mlac"
+
+struct object {
+	const void *object;
+	size_t index;
+};
+
+struct checkpoint {
+	FILE *file;
+	int failed;
+	size_t count; // of the objects
+	size_t size;
+	struct object *written; // open addressing, for the writer
+	void **read; // by index, visible to the garbage collector
+};
+
+static size_t object_slot(struct checkpoint *checkpoint, const void *object)
+{
+	size_t i = ((uintptr_t)object >> 4) * 0x9e3779b97f4a7c15ull;
+	size_t mask = checkpoint->size - 1;
+	for (i &= mask; checkpoint->written[i].object &&
+			checkpoint->written[i].object != object;
+	     i = (i + 1) & mask)
+		;
+	return i;
+}
+
+// keeps the table at most half full
+static void objects_grow(struct checkpoint *checkpoint)
+{
+	struct object *old = checkpoint->written;
+	size_t size = checkpoint->size;
+	checkpoint->size = size ? size * 2 : 1024;
+	checkpoint->written = xcalloc(checkpoint->size, sizeof(*old));
+	for (size_t i = 0; i < size; i++)
+		if (old[i].object)
+			checkpoint->written[object_slot(checkpoint,
+							old[i].object)] = old[i];
+	free(old);
+}
+
+struct checkpoint *checkpoint_writer(FILE *file)
+{
+	struct checkpoint *checkpoint = xcalloc(1, sizeof(*checkpoint));
+	checkpoint->file = file;
+	objects_grow(checkpoint);
+	fwrite(MAGIC, 1, sizeof(MAGIC) - 1, file);
+	return checkpoint;
+}
+
+struct checkpoint *checkpoint_reader(FILE *file)
+{
+	char magic[sizeof(MAGIC) - 1];
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+	    memcmp(magic, MAGIC, sizeof(magic))) {
+		fprintf(stderr, "Invalid checkpoint\n");
+		return 0;
+	}
+	struct checkpoint *checkpoint = xcalloc(1, sizeof(*checkpoint));
+	checkpoint->file = file;
+	return checkpoint;
+}
+
+void checkpoint_fail(struct checkpoint *checkpoint)
+{
+	checkpoint->failed = 1;
+}
+
+int checkpoint_failed(struct checkpoint *checkpoint)
+{
+	return checkpoint->failed;
+}
+
+// returns nonzero if anything failed
+int checkpoint_close(struct checkpoint *checkpoint)
+{
+	char trailer[sizeof(TRAILER) - 1];
+	if (checkpoint->written) {
+		fwrite(TRAILER, 1, sizeof(trailer), checkpoint->file);
+		if (fflush(checkpoint->file))
+			checkpoint->failed = 1;
+	} else if (fread(trailer, 1, sizeof(trailer), checkpoint->file) !=
+			   sizeof(trailer) ||
+		   memcmp(trailer, TRAILER, sizeof(trailer))) {
+		checkpoint->failed = 1;
+	}
+	int failed = checkpoint->failed || ferror(checkpoint->file);
+	if (failed)
+		fprintf(stderr, "Invalid checkpoint\n");
+	free(checkpoint->written);
+	if (checkpoint->read)
+		GC_free(checkpoint->read);
+	free(checkpoint);
+	return failed;
+}
+
+void checkpoint_write(struct checkpoint *checkpoint, uint64_t value)
+{
+	while (value >= 0x80) {
+		putc((value & 0x7f) | 0x80, checkpoint->file);
+		value >>= 7;
+	}
+	putc(value, checkpoint->file);
+}
+
+uint64_t checkpoint_read(struct checkpoint *checkpoint)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int byte = getc(checkpoint->file);
+		if (byte == EOF)
+			break;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	checkpoint->failed = 1;
+	return 0;
+}
+
+// references are 0 for null, 1 for new objects and 2 + index otherwise
+int checkpoint_write_ref(struct checkpoint *checkpoint, const void *object)
+{
+	if (!object) {
+		checkpoint_write(checkpoint, 0);
+		return 0;
+	}
+	size_t i = object_slot(checkpoint, object);
+	if (checkpoint->written[i].object) {
+		checkpoint_write(checkpoint, checkpoint->written[i].index + 2);
+		return 0;
+	}
+	checkpoint->written[i].object = object;
+	checkpoint->written[i].index = checkpoint->count++;
+	if (checkpoint->count * 2 > checkpoint->size)
+		objects_grow(checkpoint);
+	checkpoint_write(checkpoint, 1);
+	return 1;
+}
+
+int checkpoint_read_ref(struct checkpoint *checkpoint, void **object)
+{
+	*object = 0;
+	uint64_t ref = checkpoint_read(checkpoint);
+	if (ref == 1)
+		return !checkpoint->failed;
+	if (ref >= 2 && ref - 2 < checkpoint->count)
+		*object = checkpoint->read[ref - 2];
+	else if (ref)
+		checkpoint->failed = 1;
+	return 0;
+}
+
+void checkpoint_define(struct checkpoint *checkpoint, void *object)
+{
+	if (checkpoint->count == checkpoint->size) {
+		void **old = checkpoint->read;
+		checkpoint->size = checkpoint->size ? checkpoint->size * 2 :
+						      1024;
+		checkpoint->read = GC_malloc_uncollectable(
+			checkpoint->size * sizeof(*old));
+		if (!checkpoint->read) {
+			fprintf(stderr, "Out of memory!\n");
+			abort();
+		}
+		if (old) {
+			memcpy(checkpoint->read, old,
+			       checkpoint->count * sizeof(*old));
+			GC_free(old);
+		}
+	}
+	checkpoint->read[checkpoint->count++] = object;
+}
@@ -0,0 +1,320 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// crumbling abstract machine: terms are compiled to blocks, flat arrays of
+// crumbs x_i = a b where a and b are atoms (variables or abstractions),
+// which are executed in order with call-by-value, a beta step pushes the
+// crumbs of the body like the explicit substitutions of the crumbled
+// calculus, strong reduction is done like in fireball.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <crumble.h>
+#include <gc.h>
+
+struct atom {
+	enum { LOCAL, CAPTURED, BLOCK, FREE } type;
+	int index; // local 0 is the parameter, then the crumbs, or the name
+	struct block *block;
+};
+
+struct crumb {
+	struct atom fun, arg;
+};
+
+struct block {
+	int name; // of the parameter
+	struct block *parent;
+	int *names; // of the captured variables
+	struct atom *captured; // in the parent, copied to closures
+	int captures;
+	struct crumb *crumbs;
+	int count, size;
+	struct atom result;
+	struct block *next; // of the program
+};
+
+struct value {
+	enum { LAMBDA, VARIABLE, INERT } type;
+	union {
+		struct {
+			struct block *block;
+			struct value **captured;
+		} lambda;
+		int name;
+		struct {
+			struct value *fun;
+			struct value *arg;
+		} inert;
+	} u;
+	struct term *normal; // memoized read back, see copy_term
+};
+
+struct frame {
+	struct block *block;
+	struct value **captured;
+	struct value *locals[];
+};
+
+struct task {
+	struct frame *frame;
+	int pc; // next crumb
+};
+
+struct machine {
+	struct ctx *ctx;
+	void (*callback)(int, char, void *);
+	void *data;
+	int i;
+	struct block *blocks;
+	struct task *stack; // visible to the garbage collector, reused by runs
+	size_t size;
+};
+
+static struct block *block_new(struct machine *machine, struct block *parent,
+			       int name)
+{
+	struct block *block = xrealloc(0, sizeof(*block));
+	memset(block, 0, sizeof(*block));
+	block->name = name;
+	block->parent = parent;
+	block->next = machine->blocks;
+	machine->blocks = block;
+	return block;
+}
+
+static void blocks_free(struct block *block)
+{
+	while (block) {
+		struct block *next = block->next;
+		free(block->names);
+		free(block->captured);
+		free(block->crumbs);
+		free(block);
+		block = next;
+	}
+}
+
+// variables of enclosing blocks are captured by the closures, and thereby
+// by all blocks in between
+static struct atom resolve(struct block *block, int name)
+{
+	if (!block->parent) // the term itself
+		return (struct atom){ FREE, name, 0 };
+	if (block->name == name)
+		return (struct atom){ LOCAL, 0, 0 };
+	for (int i = 0; i < block->captures; i++)
+		if (block->names[i] == name)
+			return (struct atom){ CAPTURED, i, 0 };
+
+	struct atom outer = resolve(block->parent, name);
+	if (outer.type == FREE)
+		return outer;
+	int i = block->captures++;
+	block->names = xrealloc(block->names, (i + 1) * sizeof(*block->names));
+	block->captured =
+		xrealloc(block->captured, (i + 1) * sizeof(*block->captured));
+	block->names[i] = name;
+	block->captured[i] = outer;
+	return (struct atom){ CAPTURED, i, 0 };
+}
+
+// arguments are crumbled before functions, the crumbs are executed in the
+// order of call-by-value from right to left
+static struct atom compile(struct machine *machine, struct block *block,
+			   struct term *term)
+{
+	switch (term->type) {
+	case VAR:
+		return resolve(block, term->u.var.name);
+	case ABS:;
+		struct block *body =
+			block_new(machine, block, term->u.abs.name);
+		body->result = compile(machine, body, term->u.abs.term);
+		return (struct atom){ BLOCK, 0, body };
+	case APP:;
+		struct atom arg = compile(machine, block, term->u.app.rhs);
+		struct atom fun = compile(machine, block, term->u.app.lhs);
+		if (block->count == block->size) {
+			block->size = block->size ? block->size * 2 : 4;
+			block->crumbs =
+				xrealloc(block->crumbs,
+					 block->size * sizeof(*block->crumbs));
+		}
+		block->crumbs[block->count] = (struct crumb){ fun, arg };
+		return (struct atom){ LOCAL, ++block->count, 0 };
+	default:
+		fprintf(stderr, "Invalid term type %d\n", term->type);
+		return (struct atom){ FREE, 0, 0 };
+	}
+}
+
+static struct value *value_new(struct ctx *ctx, int type)
+{
+	struct value *value = ctx_alloc(ctx, sizeof(*value));
+	value->type = type;
+	value->normal = 0;
+	return value;
+}
+
+static struct value *variable(struct ctx *ctx, int name)
+{
+	struct value *value = value_new(ctx, VARIABLE);
+	value->u.name = name;
+	return value;
+}
+
+static struct value *atom_value(struct ctx *ctx, struct frame *frame,
+				struct atom atom)
+{
+	switch (atom.type) {
+	case LOCAL:
+		return frame->locals[atom.index];
+	case CAPTURED:
+		return frame->captured[atom.index];
+	case BLOCK:;
+		struct block *block = atom.block;
+		struct value *value = value_new(ctx, LAMBDA);
+		value->u.lambda.block = block;
+		value->u.lambda.captured =
+			ctx_alloc(ctx, block->captures * sizeof(struct value *));
+		for (int i = 0; i < block->captures; i++)
+			value->u.lambda.captured[i] =
+				atom_value(ctx, frame, block->captured[i]);
+		return value;
+	case FREE:
+	default:
+		return variable(ctx, atom.index);
+	}
+}
+
+static struct frame *frame_new(struct ctx *ctx, struct block *block,
+			       struct value **captured, struct value *arg)
+{
+	struct frame *frame = ctx_alloc(
+		ctx, sizeof(*frame) + (block->count + 1) * sizeof(arg));
+	frame->block = block;
+	frame->captured = captured;
+	frame->locals[0] = arg;
+	return frame;
+}
+
+// runs the crumbs of a block and of the bodies entered by beta steps,
+// returns 0 if the budget is exceeded
+static struct value *run(struct machine *machine, struct frame *frame)
+{
+	struct ctx *ctx = machine->ctx;
+	size_t sp = 0;
+
+	struct value *value = 0;
+	struct task task = { frame, 0 };
+	while (1) {
+		if (!ctx->fuel && ctx_check(ctx))
+			break;
+		ctx->fuel--;
+		ctx->stats.transitions++;
+
+		struct block *block = task.frame->block;
+		if (task.pc == block->count) { // return
+			machine->callback(machine->i++, 'r', machine->data);
+			value = atom_value(ctx, task.frame, block->result);
+			if (!sp)
+				break;
+			task = machine->stack[--sp];
+			task.frame->locals[++task.pc] = value;
+			continue;
+		}
+
+		struct crumb *crumb = &block->crumbs[task.pc];
+		struct value *fun = atom_value(ctx, task.frame, crumb->fun);
+		struct value *arg = atom_value(ctx, task.frame, crumb->arg);
+		if (fun->type != LAMBDA) {
+			machine->callback(machine->i++, 'i', machine->data);
+			struct value *inert = value_new(ctx, INERT);
+			inert->u.inert.fun = fun;
+			inert->u.inert.arg = arg;
+			task.frame->locals[++task.pc] = inert;
+			continue;
+		}
+
+		machine->callback(machine->i++, 'b', machine->data);
+		if (sp + 2 >= machine->size) {
+			size_t size = machine->size ? machine->size * 2 : 1024;
+			struct task *stack = GC_malloc(size * sizeof(*stack));
+			if (!stack) {
+				fprintf(stderr, "Out of memory!\n");
+				abort();
+			}
+			if (machine->stack)
+				memcpy(stack, machine->stack,
+				       machine->size * sizeof(*stack));
+			machine->stack = stack;
+			machine->size = size;
+		}
+		machine->stack[sp++] = task;
+		task.frame = frame_new(ctx, fun->u.lambda.block,
+				       fun->u.lambda.captured, arg);
+		task.pc = 0;
+	}
+
+	return ctx_exceeded(ctx) ? 0 : value;
+}
+
+static struct term *read_back(struct machine *machine, struct value *value)
+{
+	struct ctx *ctx = machine->ctx;
+	if (value->normal)
+		return copy_term(ctx, value->normal);
+
+	struct term *term = 0;
+	switch (value->type) {
+	case LAMBDA:;
+		int x = ctx_name(ctx);
+		struct value *body = run(
+			machine, frame_new(ctx, value->u.lambda.block,
+					   value->u.lambda.captured,
+					   variable(ctx, x)));
+		struct term *normal = body ? read_back(machine, body) : 0;
+		if (!normal)
+			return 0;
+		term = output_term(ctx, ABS);
+		term->u.abs.name = x;
+		term->u.abs.term = normal;
+		break;
+	case VARIABLE:
+		term = output_term(ctx, VAR);
+		term->u.var.name = value->u.name;
+		term->u.var.type = BARENDREGT_VARIABLE;
+		return term;
+	case INERT:;
+		struct term *lhs = read_back(machine, value->u.inert.fun);
+		struct term *rhs = lhs ? read_back(machine, value->u.inert.arg) :
+					 0;
+		if (!rhs)
+			return 0;
+		term = output_term(ctx, APP);
+		term->u.app.lhs = lhs;
+		term->u.app.rhs = rhs;
+		break;
+	default:
+		fprintf(stderr, "Invalid value type %d\n", value->type);
+		return 0;
+	}
+	value->normal = term;
+	return term;
+}
+
+// returns 0 if the budget is exceeded, ctx->exceeded tells which limit
+struct term *crumble(struct ctx *ctx, struct term *term,
+		     void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	struct machine machine = { ctx, callback, data, 0, 0, 0, 0 };
+	struct block *top = block_new(&machine, 0, 0);
+	top->result = compile(&machine, top, term);
+
+	struct value *value = run(&machine, frame_new(ctx, top, 0, 0));
+	struct term *res = value ? read_back(&machine, value) : 0;
+	blocks_free(machine.blocks);
+	return res;
+}
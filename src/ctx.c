@@ -0,0 +1,202 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <ctx.h>
+#include <gc.h>
+
+static void *gc_alloc(size_t size)
+{
+	return GC_malloc(size);
+}
+
+void ctx_init(struct ctx *ctx)
+{
+	ctx->name = 0x181202; // above the names generated by to_barendregt
+	ctx->parent = 0;
+	ctx->pool = 0;
+	ctx->speculate = 0;
+	ctx->remote = 0;
+	ctx->form = NORMAL_FORM;
+	ctx->engine = RKNL;
+	ctx->jit = 0;
+	ctx->optimize = 0;
+	ctx->free_vars = 0;
+	memset(&ctx->budget, 0, sizeof(ctx->budget));
+	memset(&ctx->limit, 0, sizeof(ctx->limit));
+	ctx->exceeded = WITHIN_BUDGET;
+	ctx->fuel = 0;
+	ctx->alloc = gc_alloc;
+	ctx->stats.transitions = 0;
+	ctx->stats.allocations = 0;
+	ctx->stats.allocated = 0;
+	ctx->stats.speculated = 0;
+	ctx->stats.shipped = 0;
+	ctx->stats.compiled = 0;
+	ctx->stats.lookups = 0;
+	ctx->stats.probed = 0;
+	ctx->stats.output = 0;
+}
+
+// context of a worker that reduces a part of the parent's term
+void ctx_child(struct ctx *ctx, struct ctx *parent)
+{
+	while (parent->parent)
+		parent = parent->parent;
+	ctx_init(ctx);
+	ctx->parent = parent;
+	ctx->pool = parent->pool;
+	ctx->remote = parent->remote;
+	ctx->optimize = parent->optimize;
+	ctx->alloc = parent->alloc;
+}
+
+// moves the statistics of a child to its root, may run concurrently
+void ctx_merge(struct ctx *ctx)
+{
+	struct ctx *root = ctx->parent;
+	if (!root)
+		return;
+	__atomic_add_fetch(&root->stats.transitions, ctx->stats.transitions,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.allocations, ctx->stats.allocations,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.allocated, ctx->stats.allocated,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.speculated, ctx->stats.speculated,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.shipped, ctx->stats.shipped,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.compiled, ctx->stats.compiled,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.lookups, ctx->stats.lookups,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.probed, ctx->stats.probed,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&root->stats.output, ctx->stats.output,
+			   __ATOMIC_RELAXED);
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the budget is relative to the statistics at the start of a reduction
+void ctx_start(struct ctx *ctx)
+{
+	struct budget *budget = &ctx->budget;
+	struct budget *limit = &ctx->limit;
+	limit->transitions = budget->transitions ?
+				     ctx->stats.transitions +
+					     budget->transitions :
+				     0;
+	limit->allocated =
+		budget->allocated ? ctx->stats.allocated + budget->allocated :
+				    0;
+	limit->heap = budget->heap;
+	limit->output = budget->output ? ctx->stats.output + budget->output :
+					 0;
+	limit->time = budget->time ? now() + budget->time : 0;
+	ctx->exceeded = WITHIN_BUDGET;
+	ctx->fuel = 0;
+}
+
+// called by the machines every few transitions, the limits are checked
+// against the statistics of all children merged so far
+int ctx_check(struct ctx *ctx)
+{
+	struct ctx *root = ctx->parent ? ctx->parent : ctx;
+	if (ctx->parent)
+		ctx_merge(ctx);
+	if (ctx_exceeded(ctx))
+		return 1;
+
+	struct budget *limit = &root->limit;
+	size_t transitions =
+		__atomic_load_n(&root->stats.transitions, __ATOMIC_RELAXED);
+	budget_state exceeded = WITHIN_BUDGET;
+	if (limit->transitions && transitions >= limit->transitions)
+		exceeded = TRANSITIONS_EXCEEDED;
+	else if (limit->allocated &&
+		 __atomic_load_n(&root->stats.allocated, __ATOMIC_RELAXED) >
+			 limit->allocated)
+		exceeded = ALLOCATED_EXCEEDED;
+	else if (limit->output &&
+		 __atomic_load_n(&root->stats.output, __ATOMIC_RELAXED) >
+			 limit->output)
+		exceeded = OUTPUT_EXCEEDED;
+	else if (limit->heap && GC_get_heap_size() > limit->heap)
+		exceeded = HEAP_EXCEEDED;
+	else if (limit->time && now() > limit->time)
+		exceeded = TIME_EXCEEDED;
+
+	if (exceeded) {
+		budget_state within = WITHIN_BUDGET;
+		__atomic_compare_exchange_n(&root->exceeded, &within, exceeded,
+					    0, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	ctx->fuel = 0x1000;
+	if (limit->transitions && limit->transitions - transitions < ctx->fuel)
+		ctx->fuel = limit->transitions - transitions;
+	return 0;
+}
+
+int ctx_exceeded(struct ctx *ctx)
+{
+	struct ctx *root = ctx->parent ? ctx->parent : ctx;
+	return __atomic_load_n(&root->exceeded, __ATOMIC_RELAXED) !=
+	       WITHIN_BUDGET;
+}
+
+int ctx_name(struct ctx *ctx)
+{
+	struct ctx *root = ctx->parent ? ctx->parent : ctx;
+	if (root->pool)
+		return __atomic_fetch_add(&root->name, 1, __ATOMIC_RELAXED);
+	return root->name++;
+}
+
+void *ctx_alloc(struct ctx *ctx, size_t size)
+{
+	void *ptr = ctx->alloc(size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	ctx->stats.allocations++;
+	ctx->stats.allocated += size;
+	return ptr;
+}
+
+// memory outside the garbage collected heap, the collector doesn't scan it
+void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	return ptr;
+}
+
+void *xcalloc(size_t count, size_t size)
+{
+	void *ptr = calloc(count, size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	return ptr;
+}
@@ -0,0 +1,209 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// strong call-by-value with useful sharing: terms are evaluated to fireballs
+// (abstractions or inert terms) by a CEK machine, arguments are shared by
+// the environments and bodies of abstractions are evaluated on read back,
+// at most once per value
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <fireball.h>
+#include <murmur3.h>
+#include <store.h>
+#include <gc.h>
+
+struct value {
+	enum { LAMBDA, VARIABLE, INERT } type;
+	union {
+		struct {
+			struct term *term;
+			struct store *env;
+		} lambda;
+		int name;
+		struct {
+			struct value *fun; // variable or inert
+			struct value *arg;
+		} inert;
+	} u;
+	struct term *normal; // memoized read back, see copy_term
+};
+
+struct frame {
+	enum { ARGUMENT, FUNCTION } type;
+	struct term *term; // the function of an evaluated argument
+	struct store *env;
+	struct value *value; // the argument of an evaluated function
+	struct frame *next;
+};
+
+struct machine {
+	struct ctx *ctx;
+	void (*callback)(int, char, void *);
+	void *data;
+	int i;
+};
+
+static int hash_name_equal(void *lhs, void *rhs)
+{
+	return *(int *)lhs == *(int *)rhs;
+}
+
+static uint32_t hash_name(void *key)
+{
+	return murmur3_32((uint8_t *)key, sizeof(int), 0);
+}
+
+static struct value *value_new(struct ctx *ctx, int type)
+{
+	struct value *value = ctx_alloc(ctx, sizeof(*value));
+	value->type = type;
+	value->normal = 0;
+	return value;
+}
+
+static struct value *variable(struct ctx *ctx, int name)
+{
+	struct value *value = value_new(ctx, VARIABLE);
+	value->u.name = name;
+	return value;
+}
+
+static struct frame *frame_push(struct ctx *ctx, struct frame *next, int type)
+{
+	struct frame *frame = ctx_alloc(ctx, sizeof(*frame));
+	frame->type = type;
+	frame->next = next;
+	return frame;
+}
+
+// right-to-left, arguments are evaluated before the function like in the
+// fireball machines, returns 0 if the budget is exceeded
+static struct value *evaluate(struct machine *machine, struct term *term,
+			      struct store *env)
+{
+	struct ctx *ctx = machine->ctx;
+	struct frame *stack = 0;
+	struct value *value = 0;
+	while (value ? !!stack : 1) {
+		if (!ctx->fuel && ctx_check(ctx))
+			return 0;
+		ctx->fuel--;
+		ctx->stats.transitions++;
+
+		if (value) {
+			struct frame *frame = stack;
+			stack = stack->next;
+			if (frame->type == ARGUMENT) {
+				machine->callback(machine->i++, 'f',
+						  machine->data);
+				stack = frame_push(ctx, stack, FUNCTION);
+				stack->value = value;
+				term = frame->term;
+				env = frame->env;
+				value = 0;
+			} else if (value->type == LAMBDA) { // beta by value
+				machine->callback(machine->i++, 'b',
+						  machine->data);
+				struct term *abs = value->u.lambda.term;
+				env = store_set(value->u.lambda.env,
+						&abs->u.abs.name, frame->value,
+						0);
+				term = abs->u.abs.term;
+				value = 0;
+			} else {
+				machine->callback(machine->i++, 'i',
+						  machine->data);
+				struct value *inert = value_new(ctx, INERT);
+				inert->u.inert.fun = value;
+				inert->u.inert.arg = frame->value;
+				value = inert;
+			}
+			continue;
+		}
+
+		switch (term->type) {
+		case APP:
+			machine->callback(machine->i++, 'a', machine->data);
+			stack = frame_push(ctx, stack, ARGUMENT);
+			stack->term = term->u.app.lhs;
+			stack->env = env;
+			term = term->u.app.rhs;
+			break;
+		case ABS:
+			machine->callback(machine->i++, 'l', machine->data);
+			value = value_new(ctx, LAMBDA);
+			value->u.lambda.term = term;
+			value->u.lambda.env = env;
+			break;
+		case VAR:
+			machine->callback(machine->i++, 'v', machine->data);
+			value = store_get(env, &term->u.var.name, 0);
+			if (!value) // free
+				value = variable(ctx, term->u.var.name);
+			break;
+		default:
+			fprintf(stderr, "Invalid term type %d\n", term->type);
+			return 0;
+		}
+	}
+	return value;
+}
+
+// the strong part: bodies of abstractions are evaluated with a fresh
+// variable as argument
+static struct term *read_back(struct machine *machine, struct value *value)
+{
+	struct ctx *ctx = machine->ctx;
+	if (value->normal)
+		return copy_term(ctx, value->normal);
+
+	struct term *term = 0;
+	switch (value->type) {
+	case LAMBDA:;
+		struct term *abs = value->u.lambda.term;
+		int x = ctx_name(ctx);
+		struct store *env =
+			store_set(value->u.lambda.env, &abs->u.abs.name,
+				  variable(ctx, x), 0);
+		struct value *body =
+			evaluate(machine, abs->u.abs.term, env);
+		struct term *normal = body ? read_back(machine, body) : 0;
+		if (!normal)
+			return 0;
+		term = output_term(ctx, ABS);
+		term->u.abs.name = x;
+		term->u.abs.term = normal;
+		break;
+	case VARIABLE:
+		term = output_term(ctx, VAR);
+		term->u.var.name = value->u.name;
+		term->u.var.type = BARENDREGT_VARIABLE;
+		return term;
+	case INERT:;
+		struct term *lhs = read_back(machine, value->u.inert.fun);
+		struct term *rhs = lhs ? read_back(machine, value->u.inert.arg) :
+					 0;
+		if (!rhs)
+			return 0;
+		term = output_term(ctx, APP);
+		term->u.app.lhs = lhs;
+		term->u.app.rhs = rhs;
+		break;
+	default:
+		fprintf(stderr, "Invalid value type %d\n", value->type);
+		return 0;
+	}
+	value->normal = term;
+	return term;
+}
+
+// returns 0 if the budget is exceeded, ctx->exceeded tells which limit
+struct term *fireball(struct ctx *ctx, struct term *term,
+		      void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	struct machine machine = { ctx, callback, data, 0 };
+	struct value *value = evaluate(
+		&machine, term, store_new(hash_name, hash_name_equal));
+	return value ? read_back(&machine, value) : 0;
+}
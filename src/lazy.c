@@ -0,0 +1,180 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// lazy normal forms on top of the weak head normal forms of the reducer
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <lazy.h>
+#include <reducer.h>
+#include <gc.h>
+
+struct lazy {
+	struct ctx *ctx;
+	struct term *term; // the weak head normal form once inspected
+	int inspected;
+	term_type type;
+	int name;
+	size_t arity;
+	struct lazy **children; // the body or the arguments, on demand
+};
+
+static void ignore(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
+static struct lazy *lazy_alloc(struct ctx *ctx, struct term *term,
+			       int inspected)
+{
+	struct lazy *lazy = GC_malloc(sizeof(*lazy));
+	if (!lazy) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	lazy->ctx = ctx;
+	lazy->term = term;
+	lazy->inspected = inspected;
+	lazy->type = INV;
+	lazy->children = 0;
+	return lazy;
+}
+
+// the subterms of weak head normal forms are suspended closures or already
+// in normal form, the latter don't need to be reduced again
+static int suspended(struct term *term)
+{
+	switch (term->type) {
+	case ABS:
+		return suspended(term->u.abs.term);
+	case APP:
+		return suspended(term->u.app.lhs) ||
+		       suspended(term->u.app.rhs);
+	case VAR:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+// the ctx may only be used by one thread, so does the lazy normal form
+struct lazy *lazy_new(struct ctx *ctx, struct term *term)
+{
+	return lazy_alloc(ctx, term, 0);
+}
+
+static int inspect(struct lazy *lazy)
+{
+	if (lazy->type != INV)
+		return 1;
+
+	struct term *term = lazy->term;
+	if (!lazy->inspected) {
+		struct ctx *ctx = lazy->ctx;
+		reduction_form form = ctx->form;
+		ctx->form = WEAK_HEAD_NORMAL_FORM;
+		term = reduce(ctx, term, ignore, 0);
+		ctx->form = form;
+		if (!term)
+			return 0;
+		lazy->term = term;
+		lazy->inspected = 1;
+	}
+
+	if (term->type == ABS) {
+		lazy->type = ABS;
+		lazy->name = term->u.abs.name;
+		lazy->arity = 0;
+		lazy->children = GC_malloc(sizeof(*lazy->children));
+		return 1;
+	}
+
+	size_t arity = 0;
+	for (; term->type == APP; term = term->u.app.lhs)
+		arity++;
+	if (term->type != VAR) {
+		fprintf(stderr, "Invalid head type %d\n", term->type);
+		return 0;
+	}
+	lazy->type = VAR;
+	lazy->name = term->u.var.name;
+	lazy->arity = arity;
+	lazy->children = GC_malloc((arity + 1) * sizeof(*lazy->children));
+	return 1;
+}
+
+term_type lazy_type(struct lazy *lazy)
+{
+	return inspect(lazy) ? lazy->type : INV;
+}
+
+int lazy_name(struct lazy *lazy)
+{
+	return inspect(lazy) ? lazy->name : 0;
+}
+
+size_t lazy_arity(struct lazy *lazy)
+{
+	return inspect(lazy) ? lazy->arity : 0;
+}
+
+static struct lazy *child(struct lazy *lazy, size_t i, struct term *term)
+{
+	if (!lazy->children[i])
+		lazy->children[i] = lazy_alloc(lazy->ctx, term,
+					       !suspended(term));
+	return lazy->children[i];
+}
+
+// arguments are counted from the head
+struct lazy *lazy_argument(struct lazy *lazy, size_t i)
+{
+	if (!inspect(lazy) || lazy->type != VAR || i >= lazy->arity)
+		return 0;
+	struct term *term = lazy->term;
+	for (size_t j = lazy->arity - 1; j > i; j--)
+		term = term->u.app.lhs;
+	return child(lazy, i, term->u.app.rhs);
+}
+
+struct lazy *lazy_body(struct lazy *lazy)
+{
+	if (!inspect(lazy) || lazy->type != ABS)
+		return 0;
+	return child(lazy, 0, lazy->term->u.abs.term);
+}
+
+struct term *lazy_normalize(struct lazy *lazy)
+{
+	if (!inspect(lazy))
+		return 0;
+
+	struct term *term;
+	if (lazy->type == ABS) {
+		struct term *body = lazy_normalize(lazy_body(lazy));
+		if (!body)
+			return 0;
+		term = new_term(ABS);
+		term->u.abs.name = lazy->name;
+		term->u.abs.term = body;
+		return term;
+	}
+
+	term = new_term(VAR);
+	term->u.var.name = lazy->name;
+	term->u.var.type = BARENDREGT_VARIABLE;
+	for (size_t i = 0; i < lazy->arity; i++) {
+		struct term *argument =
+			lazy_normalize(lazy_argument(lazy, i));
+		if (!argument) {
+			free_term(term);
+			return 0;
+		}
+		struct term *app = new_term(APP);
+		app->u.app.lhs = term;
+		app->u.app.rhs = argument;
+		term = app;
+	}
+	return term;
+}
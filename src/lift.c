@@ -0,0 +1,347 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// supercombinators: nested abstractions are lambda lifted into combinators
+// of fixed arity, whose first parameters are the free variables of the
+// abstractions -- saturated applications of combinators are instantiated in
+// one step and the root of the redex is updated with the result, partial
+// applications are read back as abstractions by applying them to fresh
+// variables
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <lift.h>
+#include <gc.h>
+
+// bodies of the combinators
+struct template {
+	enum { T_APP, T_PARAM, T_COMB, T_FREE } type;
+	union {
+		struct {
+			struct template *lhs, *rhs;
+		} app;
+		int index; // of the parameter or combinator
+		int name;
+	} u;
+};
+
+struct combinator {
+	int arity;
+	struct template *body;
+};
+
+struct program {
+	struct combinator *combinators;
+	int count;
+};
+
+// names of the parameters of the combinator that is compiled
+struct scope {
+	int *names;
+	int count;
+};
+
+struct node {
+	enum { N_APP, N_COMB, N_VAR, N_IND } type;
+	union {
+		struct {
+			struct node *fun, *arg;
+		} app;
+		int comb;
+		int name;
+		struct node *ind; // result of an instantiation
+	} u;
+	struct term *normal; // memoized read back, see copy_term
+};
+
+struct machine {
+	struct ctx *ctx;
+	void (*callback)(int, char, void *);
+	void *data;
+	int i;
+	struct program program;
+	struct node **stack; // of the spine, visible to the garbage collector
+	size_t sp, size;
+};
+
+static struct template *template_new(int type)
+{
+	struct template *template = xrealloc(0, sizeof(*template));
+	template->type = type;
+	return template;
+}
+
+static void template_free(struct template *template)
+{
+	if (template->type == T_APP) {
+		template_free(template->u.app.lhs);
+		template_free(template->u.app.rhs);
+	}
+	free(template);
+}
+
+static int scope_index(struct scope *scope, int name)
+{
+	for (int i = scope->count - 1; i >= 0; i--)
+		if (scope->names[i] == name)
+			return i;
+	return -1;
+}
+
+static void scope_add(struct scope *scope, int name)
+{
+	scope->names = xrealloc(scope->names,
+				(scope->count + 1) * sizeof(*scope->names));
+	scope->names[scope->count++] = name;
+}
+
+// variables of the scope that occur free in the term
+static void free_variables(struct term *term, struct scope *scope,
+			   struct scope *bound, struct scope *captured)
+{
+	switch (term->type) {
+	case ABS:
+		scope_add(bound, term->u.abs.name);
+		free_variables(term->u.abs.term, scope, bound, captured);
+		bound->count--;
+		break;
+	case APP:
+		free_variables(term->u.app.lhs, scope, bound, captured);
+		free_variables(term->u.app.rhs, scope, bound, captured);
+		break;
+	case VAR:;
+		int name = term->u.var.name;
+		if (scope_index(bound, name) < 0 &&
+		    scope_index(scope, name) >= 0 &&
+		    scope_index(captured, name) < 0)
+			scope_add(captured, name);
+		break;
+	default:
+		fprintf(stderr, "Invalid term type %d\n", term->type);
+	}
+}
+
+static struct template *lift_term(struct program *program, struct term *term,
+				  struct scope *scope)
+{
+	struct template *template;
+	switch (term->type) {
+	case ABS:;
+		struct scope captured = { 0 }, bound = { 0 };
+		free_variables(term, scope, &bound, &captured);
+		free(bound.names);
+
+		int comb = program->count++;
+		program->combinators = xrealloc(
+			program->combinators,
+			program->count * sizeof(*program->combinators));
+		struct scope params = { 0 };
+		for (int i = 0; i < captured.count; i++)
+			scope_add(&params, captured.names[i]);
+		while (term->type == ABS) {
+			scope_add(&params, term->u.abs.name);
+			term = term->u.abs.term;
+		}
+		struct template *body = lift_term(program, term, &params);
+		program->combinators[comb].arity = params.count;
+		program->combinators[comb].body = body;
+		free(params.names);
+
+		template = template_new(T_COMB);
+		template->u.index = comb;
+		for (int i = 0; i < captured.count; i++) {
+			struct template *app = template_new(T_APP);
+			app->u.app.lhs = template;
+			app->u.app.rhs = template_new(T_PARAM);
+			app->u.app.rhs->u.index =
+				scope_index(scope, captured.names[i]);
+			template = app;
+		}
+		free(captured.names);
+		return template;
+	case APP:
+		template = template_new(T_APP);
+		template->u.app.lhs = lift_term(program, term->u.app.lhs, scope);
+		template->u.app.rhs = lift_term(program, term->u.app.rhs, scope);
+		return template;
+	case VAR:;
+		int index = scope_index(scope, term->u.var.name);
+		template = template_new(index < 0 ? T_FREE : T_PARAM);
+		if (index < 0)
+			template->u.name = term->u.var.name;
+		else
+			template->u.index = index;
+		return template;
+	default:
+		fprintf(stderr, "Invalid term type %d\n", term->type);
+		abort();
+	}
+}
+
+static struct node *node_new(struct ctx *ctx, int type)
+{
+	struct node *node = ctx_alloc(ctx, sizeof(*node));
+	node->type = type;
+	node->normal = 0;
+	return node;
+}
+
+static struct node *instantiate(struct ctx *ctx, struct template *template,
+				struct node **args)
+{
+	struct node *node;
+	switch (template->type) {
+	case T_APP:
+		node = node_new(ctx, N_APP);
+		node->u.app.fun = instantiate(ctx, template->u.app.lhs, args);
+		node->u.app.arg = instantiate(ctx, template->u.app.rhs, args);
+		return node;
+	case T_PARAM:
+		return args[template->u.index];
+	case T_COMB:
+		node = node_new(ctx, N_COMB);
+		node->u.comb = template->u.index;
+		return node;
+	case T_FREE:
+	default:
+		node = node_new(ctx, N_VAR);
+		node->u.name = template->u.name;
+		return node;
+	}
+}
+
+static struct node *follow(struct node *node)
+{
+	while (node->type == N_IND)
+		node = node->u.ind;
+	return node;
+}
+
+// reduces the node until its head is a variable or an unsaturated
+// combinator, returns 0 if the budget is exceeded
+static int whnf(struct machine *machine, struct node *node)
+{
+	struct ctx *ctx = machine->ctx;
+	size_t base = machine->sp;
+	struct node *args[64];
+	while (1) {
+		if (!ctx->fuel && ctx_check(ctx)) {
+			machine->sp = base;
+			return 0;
+		}
+		ctx->fuel--;
+		ctx->stats.transitions++;
+
+		node = follow(node);
+		if (node->type == N_APP) {
+			machine->callback(machine->i++, 'u', machine->data);
+			if (machine->sp == machine->size) {
+				machine->size = machine->size ?
+							machine->size * 2 :
+							1024;
+				struct node **stack = GC_malloc(
+					machine->size * sizeof(*stack));
+				if (!stack) {
+					fprintf(stderr, "Out of memory!\n");
+					abort();
+				}
+				for (size_t i = 0; i < machine->sp; i++)
+					stack[i] = machine->stack[i];
+				machine->stack = stack;
+			}
+			machine->stack[machine->sp++] = node;
+			node = node->u.app.fun;
+			continue;
+		}
+
+		struct combinator *comb =
+			node->type == N_COMB ?
+				&machine->program.combinators[node->u.comb] :
+				0;
+		if (!comb || (size_t)comb->arity > machine->sp - base)
+			break;
+
+		machine->callback(machine->i++, 's', machine->data);
+		struct node **params = args;
+		if (comb->arity > 64)
+			params = ctx_alloc(ctx, comb->arity * sizeof(*params));
+		for (int i = 0; i < comb->arity; i++)
+			params[i] = machine->stack[machine->sp - 1 - i]
+					    ->u.app.arg;
+		struct node *res = instantiate(ctx, comb->body, params);
+		machine->sp -= comb->arity;
+		struct node *root = comb->arity ? machine->stack[machine->sp] :
+						  node; // the whole term
+		root->type = N_IND; // update the root of the redex
+		root->u.ind = res;
+		node = res;
+	}
+	machine->sp = base;
+	return 1;
+}
+
+static struct term *read_back(struct machine *machine, struct node *node)
+{
+	struct ctx *ctx = machine->ctx;
+	if (!whnf(machine, node))
+		return 0;
+	node = follow(node);
+	if (node->normal)
+		return copy_term(ctx, node->normal);
+
+	struct term *term;
+	struct node *head = node;
+	while (head->type == N_APP)
+		head = follow(head->u.app.fun);
+
+	if (head->type == N_COMB) { // partial application
+		int x = ctx_name(ctx);
+		struct node *app = node_new(ctx, N_APP);
+		app->u.app.fun = node;
+		app->u.app.arg = node_new(ctx, N_VAR);
+		app->u.app.arg->u.name = x;
+		struct term *body = read_back(machine, app);
+		if (!body)
+			return 0;
+		term = output_term(ctx, ABS);
+		term->u.abs.name = x;
+		term->u.abs.term = body;
+	} else if (node->type == N_APP) {
+		struct term *lhs = read_back(machine, node->u.app.fun);
+		struct term *rhs =
+			lhs ? read_back(machine, node->u.app.arg) : 0;
+		if (!rhs)
+			return 0;
+		term = output_term(ctx, APP);
+		term->u.app.lhs = lhs;
+		term->u.app.rhs = rhs;
+	} else {
+		term = output_term(ctx, VAR);
+		term->u.var.name = node->u.name;
+		term->u.var.type = BARENDREGT_VARIABLE;
+		return term;
+	}
+	node->normal = term;
+	return term;
+}
+
+// returns 0 if the budget is exceeded, ctx->exceeded tells which limit
+struct term *lift(struct ctx *ctx, struct term *term,
+		  void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	struct machine machine = { ctx, callback, data, 0, { 0, 1 }, 0, 0, 0 };
+	machine.program.combinators =
+		xrealloc(0, sizeof(*machine.program.combinators));
+	struct scope scope = { 0 };
+	struct template *body = lift_term(&machine.program, term, &scope);
+	machine.program.combinators[0].arity = 0;
+	machine.program.combinators[0].body = body;
+
+	struct node *start = node_new(ctx, N_COMB);
+	start->u.comb = 0;
+	struct term *res = read_back(&machine, start);
+	for (int i = 0; i < machine.program.count; i++)
+		template_free(machine.program.combinators[i].body);
+	free(machine.program.combinators);
+	return res;
+}
@@ -6,10 +6,16 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <reducer.h>
+#include <batch.h>
+#include <pool.h>
+#include <remote.h>
 #include <gc.h>
 #include <parse.h>
+#include <trace.h>
 
 static void callback(int i, char ch, void *data)
 {
@@ -19,6 +25,99 @@ static void callback(int i, char ch, void *data)
 	/* printf("%d: %c\n", i, ch); */
 }
 
+static const char *exceeded[] = {
+	[WITHIN_BUDGET] = "none",
+	[TRANSITIONS_EXCEEDED] = "transitions",
+	[ALLOCATED_EXCEEDED] = "allocated bytes",
+	[HEAP_EXCEEDED] = "heap size",
+	[OUTPUT_EXCEEDED] = "output size",
+	[TIME_EXCEEDED] = "time",
+	[CANCELLED] = "cancelled",
+};
+
+static const char *engines[] = {
+	[RKNL] = "rknl",
+	[FIREBALL] = "fireball",
+	[CRUMBLING] = "crumble",
+	[INTERACTION] = "net",
+	[BYTECODE] = "vm",
+	[SUPERCOMBINATOR] = "lift",
+};
+
+// bit i of the set enables optimizations[i]
+static const char *optimizations[] = {
+	"nary",
+	"fuse",
+	"atomic",
+	"trim",
+	"linear",
+};
+
+// writes the checkpoint in a forked process, so the reduction continues on
+// copy-on-write pages meanwhile, skipped if the previous one isn't done yet
+static pid_t snapshot(struct reduction *reduction, const char *path,
+		      pid_t previous)
+{
+	if (previous > 0 && !waitpid(previous, 0, WNOHANG))
+		return previous;
+
+	fflush(0);
+	pid_t pid = fork();
+	if (pid)
+		return pid;
+
+	char tmp[strlen(path) + 5];
+	sprintf(tmp, "%s.tmp", path);
+	FILE *file = fopen(tmp, "wb");
+	if (!file) {
+		fprintf(stderr, "Can't open file %s: %s\n", tmp,
+			strerror(errno));
+		_exit(1);
+	}
+	int ret = reduce_checkpoint(reduction, file);
+	ret |= fsync(fileno(file));
+	ret |= fclose(file);
+	if (ret || rename(tmp, path)) {
+		unlink(tmp);
+		_exit(1);
+	}
+	_exit(0);
+}
+
+// resumes the reduction of the checkpoint if there is one
+static int reduce_checkpointed(struct ctx *ctx, struct term *term,
+			       const char *path, size_t interval,
+			       struct term **reduced)
+{
+	struct reduction *reduction = 0;
+	FILE *file = fopen(path, "rb");
+	if (file) {
+		reduction = reduce_restore(ctx, file, callback, 0);
+		fclose(file);
+		if (!reduction) {
+			fprintf(stderr, "Can't resume from %s\n", path);
+			return 1;
+		}
+		fprintf(stderr, "resumed after %zu transitions\n",
+			ctx->stats.transitions);
+	} else {
+		reduction = reduce_start(ctx, term, callback, 0);
+	}
+
+	pid_t pid = 0;
+	while (!reduce_run(reduction, interval ? interval : 1))
+		pid = snapshot(reduction, path, pid);
+	if (pid > 0)
+		waitpid(pid, 0, 0);
+	if (ctx_exceeded(ctx) && (pid = snapshot(reduction, path, 0)) > 0)
+		waitpid(pid, 0, 0);
+
+	*reduced = reduce_finish(reduction);
+	if (*reduced) // the budget may be raised to resume otherwise
+		unlink(path);
+	return 0;
+}
+
 #define BUF_SIZE 1024
 static char *read_stdin(void)
 {
@@ -77,18 +176,159 @@ static char *read_file(const char *path)
 int main(int argc, char **argv)
 {
 	GC_INIT();
+	GC_allow_register_threads();
 	GC_enable_incremental();
 
-	if (argc < 2) {
+	// calm [-b] [-j<workers>] [-p<workers>] [-s<budget>] [-r<addresses>]
+	//      [-t<transitions>] [-m<bytes>] [-H<bytes>] [-o<nodes>]
+	//      [-d<seconds>] [-c<checkpoint>] [-C<transitions>] [-e<engine>]
+	//      [-J<applications>] [-O[<optimization>,...]]
+	//      <file|->
+	// calm [-p<workers>] -l<address>
+	// calm -T[<length>] <trace>...
+	struct budget budget = { 0 };
+	int workers = 0;
+	int parallel = 0;
+	size_t speculate = 0;
+	const char *remotes = 0;
+	const char *address = 0;
+	const char *checkpoint = 0;
+	size_t interval = 1 << 24;
+	reduction_engine engine = RKNL;
+	size_t jit = 0;
+	unsigned optimize = 0;
+	size_t mine = 0;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+		if (!strcmp(argv[arg], "-b")) {
+			workers = sysconf(_SC_NPROCESSORS_ONLN);
+		} else if (!strncmp(argv[arg], "-j", 2)) {
+			workers = atoi(argv[arg] + 2);
+		} else if (!strncmp(argv[arg], "-p", 2)) {
+			parallel = argv[arg][2] ? atoi(argv[arg] + 2) :
+						  sysconf(_SC_NPROCESSORS_ONLN);
+		} else if (!strncmp(argv[arg], "-s", 2)) {
+			speculate = argv[arg][2] ? strtoul(argv[arg] + 2, 0, 10) :
+						   1 << 16;
+		} else if (!strncmp(argv[arg], "-r", 2) && argv[arg][2]) {
+			remotes = argv[arg] + 2;
+		} else if (!strncmp(argv[arg], "-l", 2) && argv[arg][2]) {
+			address = argv[arg] + 2;
+		} else if (!strncmp(argv[arg], "-c", 2) && argv[arg][2]) {
+			checkpoint = argv[arg] + 2;
+		} else if (!strncmp(argv[arg], "-C", 2) && argv[arg][2]) {
+			interval = strtoul(argv[arg] + 2, 0, 10);
+		} else if (!strncmp(argv[arg], "-e", 2)) {
+			for (engine = 0; engine < sizeof(engines) /
+							 sizeof(*engines);
+			     engine++)
+				if (!strcmp(argv[arg] + 2, engines[engine]))
+					break;
+			if (engine == sizeof(engines) / sizeof(*engines)) {
+				fprintf(stderr, "Invalid engine %s\n",
+					argv[arg] + 2);
+				return 1;
+			}
+		} else if (!strncmp(argv[arg], "-J", 2)) {
+			jit = argv[arg][2] ? strtoul(argv[arg] + 2, 0, 10) : 64;
+		} else if (!strcmp(argv[arg], "-O")) {
+			optimize = ~0u;
+		} else if (!strncmp(argv[arg], "-O", 2)) {
+			for (char *name = strtok(argv[arg] + 2, ","); name;
+			     name = strtok(0, ",")) {
+				size_t i = 0;
+				for (; i < sizeof(optimizations) /
+						   sizeof(*optimizations);
+				     i++)
+					if (!strcmp(name, optimizations[i]))
+						break;
+				if (i == sizeof(optimizations) /
+						 sizeof(*optimizations)) {
+					fprintf(stderr,
+						"Invalid optimization %s\n",
+						name);
+					return 1;
+				}
+				optimize |= 1u << i;
+			}
+		} else if (!strncmp(argv[arg], "-T", 2)) {
+			mine = argv[arg][2] ? strtoul(argv[arg] + 2, 0, 10) : 4;
+		} else if (!strncmp(argv[arg], "-t", 2)) {
+			budget.transitions = strtoul(argv[arg] + 2, 0, 10);
+		} else if (!strncmp(argv[arg], "-m", 2)) {
+			budget.allocated = strtoul(argv[arg] + 2, 0, 10);
+		} else if (!strncmp(argv[arg], "-H", 2)) {
+			budget.heap = strtoul(argv[arg] + 2, 0, 10);
+		} else if (!strncmp(argv[arg], "-o", 2)) {
+			budget.output = strtoul(argv[arg] + 2, 0, 10);
+		} else if (!strncmp(argv[arg], "-d", 2)) {
+			budget.time = strtod(argv[arg] + 2, 0);
+		} else {
+			fprintf(stderr, "Invalid argument %s\n", argv[arg]);
+			return 1;
+		}
+	}
+
+	// frequent sequences of transitions in traces like tests/*.trans
+	if (mine) {
+		struct trace *trace = trace_new(mine);
+		for (; arg < argc; arg++) {
+			char *transitions = argv[arg][0] == '-' ?
+						    read_stdin() :
+						    read_file(argv[arg]);
+			if (!transitions) {
+				trace_free(trace);
+				return 1;
+			}
+			trace_add(trace, transitions);
+			free(transitions);
+		}
+		trace_print(trace, stdout, 16);
+		trace_free(trace);
+		return 0;
+	}
+
+	// worker process for the subterms of other calm processes
+	if (address) {
+		int fd = remote_listen(address);
+		return fd < 0 ? 1 : remote_serve(fd, parallel);
+	}
+
+	if (checkpoint && (parallel || remotes || workers || engine)) {
+		fprintf(stderr, "Checkpoints need sequential mode\n");
+		return 1;
+	}
+
+	if (arg >= argc) {
 		fprintf(stderr, "Invalid arguments\n");
 		return 1;
 	}
 
+	// batch mode: one term per line, reduced by a pool of workers
+	if (workers) {
+		FILE *in = stdin;
+		if (argv[arg][0] != '-' && !(in = fopen(argv[arg], "rb"))) {
+			fprintf(stderr, "Can't open file %s: %s\n", argv[arg],
+				strerror(errno));
+			return 1;
+		}
+		struct ctx settings;
+		ctx_init(&settings);
+		settings.budget = budget;
+		settings.engine = engine;
+		settings.jit = jit;
+		settings.optimize = optimize;
+		int ret = batch(in, workers, &settings);
+		if (in != stdin)
+			fclose(in);
+		return ret;
+	}
+
 	char *input;
-	if (argv[1][0] == '-') {
+	if (argv[arg][0] == '-') {
 		input = read_stdin();
 	} else {
-		input = read_file(argv[1]);
+		input = read_file(argv[arg]);
 	}
 
 	if (!input)
@@ -96,18 +336,65 @@ int main(int argc, char **argv)
 
 	struct term *parsed = parse_blc(input);
 
+	struct ctx ctx;
+	ctx_init(&ctx);
+	if (remotes && !(ctx.remote = remote_connect(remotes)))
+		return 1;
+	// the pool's workers wait for the worker processes
+	if (ctx.remote && !parallel)
+		parallel = sysconf(_SC_NPROCESSORS_ONLN) +
+			   remote_connections(ctx.remote);
+	if (parallel)
+		ctx.pool = pool_new(parallel);
+	ctx.speculate = speculate;
+	ctx.budget = budget;
+	ctx.engine = engine;
+	ctx.jit = jit;
+	ctx.optimize = optimize;
+
 	clock_t begin = clock();
-	struct term *reduced = reduce(parsed, callback, 0);
+	struct term *reduced;
+	if (!checkpoint)
+		reduced = reduce(&ctx, parsed, callback, 0);
+	else if (reduce_checkpointed(&ctx, parsed, checkpoint, interval,
+				     &reduced))
+		return 1;
 	clock_t end = clock();
-	fprintf(stderr, "reduced in %.5fs\n",
-		(double)(end - begin) / CLOCKS_PER_SEC);
+	fprintf(stderr, "reduced in %.5fs (%zu transitions, %zu bytes)\n",
+		(double)(end - begin) / CLOCKS_PER_SEC, ctx.stats.transitions,
+		ctx.stats.allocated);
+	if (ctx.pool && ctx.speculate)
+		fprintf(stderr, "%zu %s speculatively\n", ctx.stats.speculated,
+			ctx.engine == INTERACTION ? "pairs reduced" :
+						    "boxes evaluated");
+	if (ctx.remote)
+		fprintf(stderr, "%zu subterms normalized remotely\n",
+			ctx.stats.shipped);
+	if (ctx.stats.probed)
+		fprintf(stderr, "%zu of %zu variable lookups probed before (%.1f%%)\n",
+			ctx.stats.probed, ctx.stats.lookups,
+			100.0 * ctx.stats.probed / ctx.stats.lookups);
+	if (ctx.engine == BYTECODE && ctx.jit)
+		fprintf(stderr, "%zu bodies compiled to native code\n",
+			ctx.stats.compiled);
 
-	to_bruijn(reduced);
-	print_blc(reduced);
-	free_term(reduced);
+	int ret = 0;
+	if (reduced) {
+		to_bruijn(reduced);
+		print_blc(reduced);
+		free_term(reduced);
+	} else {
+		fprintf(stderr, "Budget exceeded: %s\n",
+			exceeded[ctx.exceeded]);
+		ret = 2;
+	}
 	free_term(parsed);
 	free(input);
-	return 0;
+	if (ctx.pool)
+		pool_destroy(ctx.pool);
+	if (ctx.remote)
+		remote_disconnect(ctx.remote);
+	return ret;
 }
 #else
 __attribute__((unused)) static int testing;
@@ -0,0 +1,1101 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// optimal reduction: terms are translated to sharing graphs of Lamping's
+// algorithm, where fans share subgraphs and brackets and croissants keep
+// track of the levels of the fans, see Asperti and Guerrini, The Optimal
+// Implementation of Functional Programming Languages -- all rules only
+// rewrite a pair of nodes connected by their principal ports, the pairs
+// needed by the read back are reduced one after another, or with a pool in
+// rounds of pairs that don't touch each other
+// adjacent brackets and croissants are merged into a single node holding
+// all of them in order, a node passes such a sequence in one interaction
+// with exactly the effect of passing them one by one -- unlike merging them
+// into a single generalized operator this needs no safety condition, and
+// as the sequence summarizes its levels a node or a sequence above or below
+// it passes in constant time -- fans also carry the sequences in front of
+// their ports, like the replicators of Lambdascope, so brackets and
+// croissants only become nodes of their own where a fan can not take them
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <net.h>
+#include <pool.h>
+#include <gc.h>
+
+#define PART 256 // active pairs of a round per task at least
+
+// principal ports are 0, for applications the function
+enum node_type {
+	ROOT, // of a read back
+	LAMBDA, // body 1, variable 2
+	APPLY, // root 1, argument 2
+	NEUTRAL, // application of a variable, function 1, argument 2
+	VARIABLE, // of the read back or free
+	FAN, // sharing, two auxiliary ports
+	OPERATORS, // brackets and croissants, see struct operators
+	ERASER,
+};
+
+static const int arity[] = {
+	[ROOT] = 0,    [LAMBDA] = 2,  [APPLY] = 2,	[NEUTRAL] = 2,
+	[VARIABLE] = 0, [FAN] = 2,     [OPERATORS] = 1, [ERASER] = 0,
+};
+
+// brackets (offset 1) increment the levels of nodes passing through that
+// are above their own level, croissants (offset -1) decrement them
+struct operator {
+	int level;
+	int offset;
+};
+
+// in the order they are passed coming from the principal port, as a list
+// shared by copies and never changed -- the levels of the rest of the list are
+// shifted by shift, and every element summarizes the list from itself on: a
+// level up to low passes all of it unchanged and one from high passes it
+// shifted by sum, so only a level between the two has to walk the list
+struct operators {
+	struct operator operator;
+	int shift;
+	int count;
+	int sum;
+	int low;
+	int high;
+	struct operators *next;
+};
+
+static struct operators none;
+
+struct node;
+
+struct port {
+	struct node *node;
+	int slot;
+};
+
+struct node {
+	enum node_type type;
+	int level; // or name of variables
+	struct port peer[3];
+	// of OPERATORS nodes at 0, of fans between each port and the fan
+	struct operators *operators[3];
+	int mark; // twice the last round it was claimed in, plus one in pairs
+};
+
+// a root of the read back whose term is still missing, with the path of its
+// walk to the active pair it depends on
+struct pending {
+	struct node **path;
+	size_t sp;
+	size_t size;
+	struct term **term;
+	int done; // the root is connected to the head of its term
+};
+
+// an active pair by one of its nodes, and the round it was found in
+struct pair {
+	struct node *node;
+	int round;
+};
+
+struct pairs {
+	struct pair *pair;
+	int count;
+	int size;
+};
+
+struct machine {
+	struct ctx *ctx;
+	void (*callback)(int, char, void *);
+	void *data;
+	int i;
+	size_t nodes;
+	struct pending *pending; // a stack, read back from the top
+	int count;
+	int size;
+	int round; // of parallel reduction
+	struct pairs pairs; // claimed in the round
+	// found next to the reduced ones, while pairs may still be reduced
+	// speculatively
+	struct pairs active;
+	size_t speculate;
+	struct operator *buffer[2]; // of operators being copied
+	int buffers[2];
+	int invalid;
+};
+
+// variables are translated to chains of brackets up to the level of their
+// binder, their occurrences are shared by fans at that level
+struct binder {
+	int name;
+	int level;
+	struct port *occurrences;
+	int count;
+	struct binder *next;
+};
+
+static struct node *node_new(struct machine *machine, enum node_type type,
+			     int level)
+{
+	struct node *node = ctx_alloc(machine->ctx, sizeof(*node));
+	node->type = type;
+	node->level = level;
+	for (int i = 0; i < 3; i++)
+		node->operators[i] = &none;
+	node->mark = 0;
+	machine->nodes++;
+	return node;
+}
+
+// the operator in front of the list next, whose levels are shifted by shift
+static struct operators *cons(struct machine *machine,
+			      struct operator operator, int shift,
+			      struct operators *next)
+{
+	struct operators *operators =
+		ctx_alloc(machine->ctx, sizeof(*operators));
+	operators->operator = operator;
+	operators->shift = shift;
+	operators->count = next->count + 1;
+	operators->sum = next->sum + operator.offset;
+	operators->low = operator.level;
+	operators->high = operator.level + 1;
+	operators->next = next;
+	if (next->count) {
+		if (next->low + shift < operators->low)
+			operators->low = next->low + shift;
+		if (next->high + shift - operator.offset > operators->high)
+			operators->high = next->high + shift - operator.offset;
+	}
+	return operators;
+}
+
+// the operators in the buffer followed by those of list shifted by delta,
+// only the buffer and the first element of list are copied
+static struct operators *prepend(struct machine *machine,
+				 struct operator *buffer, int count,
+				 struct operators *list, int delta)
+{
+	if (delta && list->count)
+		list = cons(machine,
+			    (struct operator){ list->operator.level + delta,
+					       list->operator.offset },
+			    list->shift + delta, list->next);
+	for (int i = count - 1; i >= 0; i--)
+		if (buffer[i].offset)
+			list = cons(machine, buffer[i], 0, list);
+	return list;
+}
+
+static struct operator *reserve(struct machine *machine, int i, int count)
+{
+	if (machine->buffers[i] < count) {
+		machine->buffers[i] = count;
+		machine->buffer[i] = xrealloc(
+			machine->buffer[i], count * sizeof(*machine->buffer[i]));
+	}
+	return machine->buffer[i];
+}
+
+static struct port port(struct node *node, int slot)
+{
+	return (struct port){ node, slot };
+}
+
+static void append(struct pairs *pairs, struct node *node, int round)
+{
+	if (pairs->count == pairs->size) {
+		pairs->size = pairs->size ? 2 * pairs->size : 64;
+		pairs->pair = xrealloc(pairs->pair,
+				       pairs->size * sizeof(*pairs->pair));
+	}
+	pairs->pair[pairs->count++] = (struct pair){ node, round };
+}
+
+static void link(struct port a, struct port b)
+{
+	a.node->peer[a.slot] = b;
+	b.node->peer[b.slot] = a;
+}
+
+static int control(struct node *node)
+{
+	return node->type >= FAN;
+}
+
+// the principal port of the node is connected to another one, roots excluded
+static int active(struct node *node)
+{
+	struct port peer = node->peer[0];
+	return !peer.slot && peer.node != node &&
+	       peer.node->peer[0].node == node && !peer.node->peer[0].slot &&
+	       node->type != ROOT && peer.node->type != ROOT;
+}
+
+static struct port translate(struct machine *machine, struct term *term,
+			     int level, struct binder *env)
+{
+	switch (term->type) {
+	case ABS:;
+		struct node *abs = node_new(machine, LAMBDA, level);
+		struct binder binder = { term->u.abs.name, level, 0, 0, env };
+		link(port(abs, 1),
+		     translate(machine, term->u.abs.term, level, &binder));
+
+		struct port var = port(abs, 2);
+		if (!binder.count)
+			link(var, port(node_new(machine, ERASER, 0), 0));
+		for (int i = 0; i < binder.count - 1; i++) {
+			struct node *fan = node_new(machine, FAN, level);
+			link(var, port(fan, 0));
+			link(port(fan, 1), binder.occurrences[i]);
+			var = port(fan, 2);
+		}
+		if (binder.count)
+			link(var, binder.occurrences[binder.count - 1]);
+		free(binder.occurrences);
+		return port(abs, 0);
+	case APP:;
+		struct node *app = node_new(machine, APPLY, level);
+		link(port(app, 0),
+		     translate(machine, term->u.app.lhs, level, env));
+		if (machine->speculate && active(app))
+			append(&machine->active, app, 0);
+		link(port(app, 2),
+		     translate(machine, term->u.app.rhs, level + 1, env));
+		return port(app, 1);
+	case VAR:;
+		struct binder *bound = env;
+		while (bound && bound->name != term->u.var.name)
+			bound = bound->next;
+		if (!bound) { // free
+			struct node *atom =
+				node_new(machine, VARIABLE, term->u.var.name);
+			return port(atom, 0);
+		}
+
+		// brackets from the binder up to the level of the occurrence,
+		// then a croissant
+		int count = level - bound->level + 1;
+		struct node *delimiter = node_new(machine, OPERATORS, 0);
+		for (int i = count - 1; i >= 0; i--)
+			delimiter->operators[0] = cons(
+				machine,
+				(struct operator){ bound->level + i,
+						   i < count - 1 ? 1 : -1 },
+				0, delimiter->operators[0]);
+		bound->occurrences = xrealloc(
+			bound->occurrences,
+			(bound->count + 1) * sizeof(*bound->occurrences));
+		bound->occurrences[bound->count++] = port(delimiter, 0);
+		return port(delimiter, 1);
+	default:
+		fprintf(stderr, "Invalid term type %d\n", term->type);
+		machine->invalid = 1;
+		return port(node_new(machine, ERASER, 0), 0);
+	}
+}
+
+// follows a wire from an auxiliary port of the pair to its end outside of
+// the pair, returns the start if the wire only loops through the pair
+static struct port follow(struct node *a, struct node *b, struct port start)
+{
+	struct port p = start;
+	while (1) {
+		p = p.node->peer[p.slot];
+		if (p.node != a && p.node != b)
+			return p;
+		// the wire enters the pair here and leaves through the
+		// same port of the other node
+		p = port(p.node == a ? b : a, p.slot);
+		// every port of the pair is visited at most once before
+		// the wire either leaves the pair or gets back to the start
+		if (p.node == start.node && p.slot == start.slot)
+			return start;
+	}
+}
+
+// the auxiliary ports of both nodes are joined pairwise, wires may pass
+// through the pair several times, closed loops are dropped
+static void annihilate(struct node *a, struct node *b)
+{
+	for (int s = 1; s <= arity[a->type]; s++) {
+		struct port ends[2] = { follow(a, b, port(a, s)),
+					follow(a, b, port(b, s)) };
+		if (ends[0].node != a && ends[0].node != b &&
+		    ends[1].node != a && ends[1].node != b)
+			link(ends[0], ends[1]);
+	}
+}
+
+// the level of a node or fan passing through all operators
+static int shift(struct operators *operators, int level)
+{
+	int delta = 0;
+	for (; operators->count; operators = operators->next) {
+		if (level >= operators->high + delta)
+			return level + operators->sum;
+		if (level <= operators->low + delta)
+			return level;
+		if (level > operators->operator.level + delta)
+			level += operators->operator.offset;
+		delta += operators->shift;
+	}
+	return level;
+}
+
+// the operators passing go through the others one after another, returns
+// the ones that pass and replaces the others by what is left of them -- the
+// higher one of two operators is shifted by the lower one, and the first
+// operator equal to a passing one annihilates with it
+// sequences entirely above or below the others pass in one step, otherwise
+// the others are only copied as far as the passing operators walked them
+static struct operators *through(struct machine *machine,
+				 struct operators **others,
+				 struct operators *passing)
+{
+	if (!passing->count || !(*others)->count)
+		return passing;
+	if (passing->low >= (*others)->high)
+		return prepend(machine, 0, 0, passing, (*others)->sum);
+	if (passing->high <= (*others)->low) {
+		*others = prepend(machine, 0, 0, *others, passing->sum);
+		return passing;
+	}
+	struct operator *walked = reserve(machine, 0, (*others)->count);
+	struct operator *passed = reserve(machine, 1, passing->count);
+	struct operators *rest = *others; // shifted by delta
+	int delta = 0;
+	// walked, annihilated ones have offset 0 and the level of the next one
+	// to look at
+	int count = 0;
+	int out = 0;
+	int shifted = 0; // of the levels of passing
+	for (; passing->count;
+	     shifted += passing->shift, passing = passing->next) {
+		struct operator operator = { passing->operator.level + shifted,
+					     passing->operator.offset };
+		int i = 0;
+		int dead = -1; // first of the annihilated ones just skipped
+		while (operator.offset) {
+			if (i == count) {
+				if (!rest->count)
+					break;
+				if (operator.level >= rest->high + delta) {
+					operator.level += rest->sum;
+					break;
+				}
+				if (operator.level < rest->low + delta) {
+					delta += operator.offset;
+					break;
+				}
+				walked[count++] = (struct operator){
+					rest->operator.level + delta,
+					rest->operator.offset
+				};
+				delta += rest->shift;
+				rest = rest->next;
+			}
+			struct operator *other = &walked[i];
+			if (!other->offset) {
+				dead = dead < 0 ? i : dead;
+				i = other->level;
+				continue;
+			}
+			if (dead >= 0)
+				walked[dead].level = i;
+			dead = -1;
+			i++;
+			if (other->level == operator.level &&
+			    other->offset == operator.offset) {
+				other->level = i;
+				other->offset = 0;
+				operator.offset = 0;
+			} else if (operator.level > other->level) {
+				operator.level += other->offset;
+			} else if (operator.level < other->level) {
+				other->level += operator.offset;
+			}
+		}
+		if (operator.offset)
+			passed[out++] = operator;
+	}
+	if (count || delta)
+		*others = prepend(machine, walked, count, rest, delta);
+	return prepend(machine, passed, out, &none, 0);
+}
+
+// the operators of first followed by those of second
+static struct operators *merge(struct machine *machine,
+			       struct operators *first,
+			       struct operators *second)
+{
+	if (!first->count)
+		return second;
+	if (!second->count)
+		return first;
+	struct operator *buffer = reserve(machine, 0, first->count);
+	int count = 0;
+	int delta = 0;
+	for (; first->count; delta += first->shift, first = first->next)
+		buffer[count++] = (struct operator){
+			first->operator.level + delta, first->operator.offset
+		};
+	return prepend(machine, buffer, count, second, 0);
+}
+
+// connects the principal port of a node with the operators to p and returns
+// its auxiliary port, or p if there are none -- operators following others
+// or a fan are merged with them
+static struct port insert(struct machine *machine, struct port p,
+			  struct operators *operators)
+{
+	if (!operators->count)
+		return p;
+	if ((p.node->type == OPERATORS || p.node->type == FAN) && p.slot) {
+		int i = p.node->type == FAN ? p.slot : 0;
+		p.node->operators[i] =
+			merge(machine, p.node->operators[i], operators);
+		return p;
+	}
+	struct node *node = node_new(machine, OPERATORS, 0);
+	node->operators[0] = operators;
+	link(port(node, 0), p);
+	return port(node, 1);
+}
+
+// the operators of a pass through those of b one after another, the passed
+// ones of both continue on the other side
+static void cross(struct machine *machine, struct node *a, struct node *b)
+{
+	struct port from = a->peer[1];
+	struct port to = b->peer[1];
+	if (from.node == b) // closed loop
+		return;
+
+	struct operators *operators = b->operators[0];
+	struct operators *passed = through(machine, &operators, a->operators[0]);
+	link(insert(machine, from, operators), insert(machine, to, passed));
+}
+
+// both nodes pass through each other, a is copied to every auxiliary port
+// of b and vice versa, the level of b is changed by the operators of a
+static void commute(struct machine *machine, struct node *a, struct node *b)
+{
+	struct node *as[2], *bs[2];
+	int level = b->level;
+	if (a->type == OPERATORS && b->type != VARIABLE && b->type != ERASER)
+		level = shift(a->operators[0], level);
+	for (int t = 0; t < arity[b->type]; t++) {
+		as[t] = node_new(machine, a->type, a->level);
+		as[t]->operators[0] = a->operators[0];
+	}
+	for (int s = 0; s < arity[a->type]; s++) {
+		bs[s] = node_new(machine, b->type, level);
+		bs[s]->operators[0] = b->operators[0];
+	}
+
+	for (int t = 0; t < arity[b->type]; t++) {
+		struct port p = b->peer[t + 1];
+		if (p.node == a)
+			p = port(bs[p.slot - 1], 0);
+		else if (p.node == b)
+			p = port(as[p.slot - 1], 0);
+		link(port(as[t], 0), p);
+		for (int s = 0; s < arity[a->type]; s++)
+			link(port(as[t], s + 1), port(bs[s], t + 1));
+	}
+	for (int s = 0; s < arity[a->type]; s++) {
+		struct port p = a->peer[s + 1];
+		if (p.node == a)
+			p = port(bs[p.slot - 1], 0);
+		else if (p.node == b)
+			p = port(as[p.slot - 1], 0);
+		link(port(bs[s], 0), p);
+	}
+}
+
+// returns 1 if an auxiliary port of b is connected to the pair
+static int loops(struct node *a, struct node *b)
+{
+	for (int t = 1; t <= arity[b->type]; t++)
+		if (b->peer[t].node == a || b->peer[t].node == b)
+			return 1;
+	return 0;
+}
+
+// b passes through the operators of a, which are copied to every auxiliary
+// port of b
+static void propagate(struct machine *machine, struct node *a, struct node *b)
+{
+	if (loops(a, b)) {
+		commute(machine, a, b);
+		return;
+	}
+
+	int level = b->level;
+	if (b->type != VARIABLE && b->type != ERASER)
+		level = shift(a->operators[0], level);
+	struct node *passed = node_new(machine, b->type, level);
+	link(port(passed, 0), a->peer[1]);
+	for (int t = 1; t <= arity[b->type]; t++)
+		link(insert(machine, b->peer[t], a->operators[0]),
+		     port(passed, t));
+}
+
+static int dressed(struct node *node)
+{
+	return node->type == FAN &&
+	       (node->operators[0]->count || node->operators[1]->count ||
+		node->operators[2]->count);
+}
+
+// b passes through the operators on the principal port of the fan a, the
+// fan and then the operators on each auxiliary port, copies of the fan with
+// all its operators are put on every auxiliary port of b
+static void replicate(struct machine *machine, struct node *a, struct node *b)
+{
+	struct node *bs[2];
+	for (int s = 0; s < 2; s++) {
+		int level = b->level;
+		if (b->type != VARIABLE && b->type != ERASER)
+			level = shift(a->operators[s + 1],
+				      shift(a->operators[0], level));
+		bs[s] = node_new(machine, b->type, level);
+		link(port(bs[s], 0), a->peer[s + 1]);
+	}
+	for (int t = 1; t <= arity[b->type]; t++) {
+		struct node *copy = node_new(machine, FAN, a->level);
+		memcpy(copy->operators, a->operators, sizeof(a->operators));
+		link(port(copy, 0), b->peer[t]);
+		for (int s = 0; s < 2; s++)
+			link(port(copy, s + 1), port(bs[s], t));
+	}
+}
+
+// the operators of b pass through the operators on the principal port of
+// the fan a and then through the fan, their copies then pass through the
+// operators on each auxiliary port
+static void traverse(struct machine *machine, struct node *a, struct node *b)
+{
+	struct operators *first = a->operators[0];
+	struct operators *passed = through(machine, &first, b->operators[0]);
+	struct node *fan = node_new(machine, FAN, shift(passed, a->level));
+	fan->operators[0] = first;
+	link(port(fan, 0), b->peer[1]);
+	for (int s = 1; s <= 2; s++) {
+		fan->operators[s] = a->operators[s];
+		struct operators *out =
+			through(machine, &fan->operators[s], passed);
+		link(port(fan, s), insert(machine, a->peer[s], out));
+	}
+}
+
+// two fans meet: the operators on their principal ports cross and pass
+// through the other fan, if the fans are at the same level then they
+// annihilate and the operators on their auxiliary ports cross, returns 0
+// otherwise without changing anything
+static int meet(struct machine *machine, struct node *a, struct node *b)
+{
+	struct operators *first[2] = { a->operators[0], b->operators[0] };
+	// those of a end up in front of b and vice versa
+	struct operators *passed[2];
+	passed[1] = through(machine, &first[1], first[0]);
+	passed[0] = first[1];
+	if (shift(passed[0], a->level) != shift(passed[1], b->level))
+		return 0;
+
+	for (int s = 1; s <= 2; s++) {
+		struct operators *after[2] = { a->operators[s],
+					       b->operators[s] };
+		struct operators *out[2];
+		for (int side = 0; side < 2; side++)
+			out[side] = through(machine, &after[side],
+					    passed[side]);
+		// the remaining operators on the ports face each other
+		struct operators *crossed = through(machine, &after[1],
+						    after[0]);
+		link(insert(machine, a->peer[s],
+			    merge(machine, out[0], after[1])),
+		     insert(machine, b->peer[s],
+			    merge(machine, out[1], crossed)));
+	}
+	return 1;
+}
+
+// moves the operators on the ports of a fan to nodes of their own
+static void expand(struct machine *machine, struct node *node)
+{
+	if (node->type != FAN)
+		return;
+	for (int slot = 0; slot < 3; slot++) {
+		if (!node->operators[slot]->count)
+			continue;
+		struct node *operators = node_new(machine, OPERATORS, 0);
+		operators->operators[0] = node->operators[slot];
+		node->operators[slot] = &none;
+		// operators on the principal port lead to the fan
+		link(port(operators, slot ? 1 : 0), node->peer[slot]);
+		link(port(operators, slot ? 0 : 1), port(node, slot));
+	}
+}
+
+// returns 0 if the pair can't interact
+static int interact(struct machine *machine, struct node *a, struct node *b)
+{
+	// a is the application of a redex or a control node if there is one
+	if (a->type == ROOT || (!control(a) && (control(b) || b->type == APPLY))) {
+		struct node *swap = a;
+		a = b;
+		b = swap;
+	}
+
+	if (a->type == APPLY && b->type == LAMBDA) {
+		machine->callback(machine->i++, 'b', machine->data);
+		annihilate(a, b);
+	} else if (a->type == APPLY &&
+		   (b->type == VARIABLE || b->type == NEUTRAL)) {
+		machine->callback(machine->i++, 'n', machine->data);
+		struct node *neutral = node_new(machine, NEUTRAL, a->level);
+		link(port(neutral, 0), a->peer[1]);
+		link(port(neutral, 1), port(b, 0));
+		link(port(neutral, 2), a->peer[2]);
+	} else if (b->type == ROOT && a->type != FAN && a->type != ERASER) {
+		// levels of the whole result are irrelevant
+		machine->callback(machine->i++, 'r', machine->data);
+		struct port p = a->peer[1];
+		link(port(b, 0), p.node == a ? port(b, 0) : p);
+	} else if (!control(a) || b->type == ROOT) {
+		return 0;
+	} else if (dressed(a) || dressed(b)) {
+		struct node *fan = dressed(a) ? a : b;
+		struct node *other = fan == a ? b : a;
+		int loop = loops(fan, other) || loops(other, fan);
+		if (other->type == FAN && !loop && meet(machine, fan, other)) {
+			machine->callback(machine->i++, 'a', machine->data);
+		} else if (other->type == FAN || loop) {
+			// the pair is rewritten by the rules of the bare nodes
+			expand(machine, a);
+			expand(machine, b);
+			if (a->peer[0].slot)
+				a = a->peer[0].node;
+			return interact(machine, a, a->peer[0].node);
+		} else if (other->type == OPERATORS) {
+			machine->callback(machine->i++, 'c', machine->data);
+			traverse(machine, fan, other);
+		} else {
+			machine->callback(machine->i++, 'c', machine->data);
+			replicate(machine, fan, other);
+		}
+	} else if (a->type == OPERATORS && b->type == OPERATORS) {
+		machine->callback(machine->i++, 'c', machine->data);
+		cross(machine, a, b);
+	} else if (b->type == OPERATORS) {
+		machine->callback(machine->i++, 'c', machine->data);
+		propagate(machine, b, a);
+	} else if (a->type == OPERATORS) {
+		machine->callback(machine->i++, 'c', machine->data);
+		propagate(machine, a, b);
+	} else if (a->type == b->type && a->level == b->level) {
+		machine->callback(machine->i++, 'a', machine->data);
+		annihilate(a, b);
+	} else if (control(b) && b->level < a->level) {
+		machine->callback(machine->i++, 'c', machine->data);
+		commute(machine, b, a);
+	} else {
+		machine->callback(machine->i++, 'c', machine->data);
+		commute(machine, a, b);
+	}
+	return 1;
+}
+
+// follows the principal ports from the top of the path until it reaches the
+// active pair it waits for, operators on the way are merged if merging --
+// walks of parallel rounds don't, the operators may be on other paths
+// returns 0 if the net is invalid
+static int walk(struct machine *machine, struct pending *pending, int merging)
+{
+	while (1) {
+		struct node *node = pending->path[pending->sp - 1];
+		struct port peer = node->peer[0];
+		if (merging && peer.slot && node->type == OPERATORS &&
+		    peer.node != node &&
+		    (peer.node->type == OPERATORS || peer.node->type == FAN)) {
+			// operators following operators or a fan are merged
+			// with them
+			int i = peer.node->type == FAN ? peer.slot : 0;
+			peer.node->operators[i] =
+				merge(machine, peer.node->operators[i],
+				      node->operators[0]);
+			link(peer, node->peer[1]);
+			pending->path[pending->sp - 1] = peer.node;
+			continue;
+		}
+		if (merging && peer.slot && node->type == FAN &&
+		    peer.node->type == OPERATORS && peer.node != node) {
+			// as are operators leading to a fan
+			node->operators[0] = merge(machine,
+						   peer.node->operators[0],
+						   node->operators[0]);
+			link(port(node, 0), peer.node->peer[0]);
+			continue;
+		}
+		if (peer.slot) { // follow the principal port of the waiting node
+			if (pending->sp == pending->size) {
+				pending->size *= 2;
+				pending->path = xrealloc(
+					pending->path,
+					pending->size * sizeof(*pending->path));
+			}
+			if (pending->sp > machine->nodes) {
+				fprintf(stderr, "Invalid net\n");
+				return 0;
+			}
+			pending->path[pending->sp++] = peer.node;
+			continue;
+		}
+
+		struct node *other = peer.node;
+		struct port next = other->peer[1];
+		if (merging && other->type == OPERATORS && !next.slot &&
+		    next.node != node && next.node->type == FAN) {
+			// operators leading to a fan are merged with it
+			next.node->operators[0] = merge(
+				machine, other->operators[0],
+				next.node->operators[0]);
+			link(port(node, 0), next);
+		}
+		return 1;
+	}
+}
+
+// the root is connected to an abstraction, a neutral application or a
+// variable
+static int finished(struct pending *pending)
+{
+	struct node *other = pending->path[0]->peer[0].node;
+	return pending->sp == 1 &&
+	       (other->type == LAMBDA || other->type == NEUTRAL ||
+		other->type == VARIABLE);
+}
+
+// reduces the active pair of the node, returns 0 if the budget is exceeded
+// or the net is invalid
+static int step(struct machine *machine, struct node *node)
+{
+	struct ctx *ctx = machine->ctx;
+	if (!ctx->fuel && ctx_check(ctx))
+		return 0;
+	ctx->fuel--;
+	ctx->stats.transitions++;
+
+	// new active pairs for speculation can only be found at the principal
+	// ports leading to the pair
+	struct node *pair[2] = { node, node->peer[0].node };
+	struct node *near[4];
+	int count = 0;
+	for (int i = 0; machine->speculate && i < 2; i++)
+		for (int t = 1; t <= arity[pair[i]->type]; t++) {
+			struct port p = pair[i]->peer[t];
+			if (!p.slot && p.node != pair[0] && p.node != pair[1])
+				near[count++] = p.node;
+		}
+
+	if (!interact(machine, pair[0], pair[1])) {
+		fprintf(stderr, "Invalid net\n");
+		machine->invalid = 1;
+		return 0;
+	}
+	for (int i = 0; i < count; i++)
+		if (active(near[i]))
+			append(&machine->active, near[i], machine->round);
+	return 1;
+}
+
+// reduces the active pairs the root depends on until it is finished, returns
+// 0 if the budget is exceeded or the net is invalid
+static int head(struct machine *machine, struct pending *pending)
+{
+	while (1) {
+		if (!walk(machine, pending, 1))
+			return 0;
+		if (finished(pending))
+			return 1;
+		if (!step(machine, pending->path[pending->sp - 1]))
+			return 0;
+		if (pending->sp > 1)
+			pending->sp--;
+	}
+}
+
+// the pair is still active, its nodes weren't reduced since it was found --
+// those of reduced pairs that are gone stay connected to each other
+static int live(struct pair pair)
+{
+	int mark = pair.node->mark;
+	return !(mark & 1 && mark > 2 * pair.round + 1) && active(pair.node);
+}
+
+// claims the pair of the node for the round if it doesn't touch the pairs
+// claimed before, only their auxiliary ports may lead to the same neighbour
+// -- the rules change nothing but the pair and the ports leading to it
+static int claim(struct machine *machine, struct node *node)
+{
+	int mark = 2 * machine->round;
+	struct node *pair[2] = { node, node->peer[0].node };
+	for (int i = 0; i < 2; i++) {
+		if (pair[i]->mark >= mark)
+			return 0;
+		for (int t = 1; t <= arity[pair[i]->type]; t++)
+			if (pair[i]->peer[t].node->mark == mark + 1)
+				return 0;
+	}
+	pair[0]->mark = pair[1]->mark = mark + 1;
+	for (int i = 0; i < 2; i++)
+		for (int t = 1; t <= arity[pair[i]->type]; t++)
+			if (pair[i]->peer[t].node->mark != mark + 1)
+				pair[i]->peer[t].node->mark = mark;
+	return 1;
+}
+
+static void ignore(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
+// pairs of a round reduced by a worker of the pool with a machine of its
+// own, the callback only observes the transitions of the root machine
+struct part {
+	struct machine machine;
+	struct ctx ctx;
+	struct pair *pairs;
+	int count;
+};
+
+static void part_run(void *data)
+{
+	struct part *part = data;
+	for (int i = 0; i < part->count; i++)
+		if (!step(&part->machine, part->pairs[i].node))
+			break;
+	ctx_merge(&part->ctx);
+}
+
+// every root walks to the active pair it depends on, the pairs found next to
+// reduced ones are taken while the speculation budget lasts, and all of them
+// that don't touch each other are reduced at once, by the pool if there are
+// enough -- returns 0 if the budget is exceeded or the net is invalid
+static int parallel(struct machine *machine)
+{
+	struct ctx *ctx = machine->ctx;
+	struct pairs *pairs = &machine->pairs;
+	int round = ++machine->round;
+	pairs->count = 0;
+	for (int i = 0; i < machine->count; i++) {
+		struct pending *pending = &machine->pending[i];
+		if (!walk(machine, pending, machine->count == 1))
+			return 0;
+		pending->done = finished(pending);
+		struct node *node = pending->path[pending->sp - 1];
+		if (!pending->done && claim(machine, node))
+			append(pairs, node, round);
+	}
+
+	// only the most recently found ones are looked at, those touching a
+	// claimed pair wait for a later round
+	struct pairs *active = &machine->active;
+	int limit = pool_workers(ctx->pool) * PART;
+	int from = active->count > 2 * limit ? active->count - 2 * limit : 0;
+	int kept = from;
+	size_t speculated = 0;
+	for (int i = from; i < active->count; i++) {
+		struct pair pair = active->pair[i];
+		if (!live(pair))
+			continue;
+		if (speculated < machine->speculate &&
+		    claim(machine, pair.node)) {
+			append(pairs, pair.node, round);
+			speculated++;
+			continue;
+		}
+		active->pair[kept++] = pair;
+	}
+	active->count = machine->speculate > speculated ? kept : 0;
+	machine->speculate -= speculated;
+	ctx->stats.speculated += speculated;
+
+	int tasks = pairs->count / PART;
+	if (tasks > pool_workers(ctx->pool))
+		tasks = pool_workers(ctx->pool);
+	if (tasks < 2) {
+		for (int i = 0; i < pairs->count; i++)
+			if (!step(machine, pairs->pair[i].node))
+				return 0;
+	} else {
+		struct part *part = xcalloc(tasks, sizeof(*part));
+		for (int t = 0; t < tasks; t++) {
+			int first = pairs->count * t / tasks;
+			ctx_child(&part[t].ctx, ctx);
+			part[t].machine.ctx = &part[t].ctx;
+			part[t].machine.callback = ignore;
+			part[t].machine.round = round;
+			part[t].machine.speculate = machine->speculate;
+			part[t].pairs = pairs->pair + first;
+			part[t].count = pairs->count * (t + 1) / tasks - first;
+			pool_submit(ctx->pool, part_run, &part[t]);
+		}
+		pool_wait(ctx->pool);
+		for (int t = 0; t < tasks; t++) {
+			struct machine *worker = &part[t].machine;
+			machine->nodes += worker->nodes;
+			machine->invalid |= worker->invalid;
+			for (int i = 0; i < worker->active.count; i++)
+				append(active, worker->active.pair[i].node,
+				       round);
+			free(worker->active.pair);
+			free(worker->buffer[0]);
+			free(worker->buffer[1]);
+		}
+		free(part);
+		if (machine->invalid || ctx_exceeded(ctx))
+			return 0;
+	}
+
+	// the tops of the paths that were part of a pair are gone
+	for (int i = 0; i < machine->count; i++) {
+		struct pending *pending = &machine->pending[i];
+		if (pending->sp > 1 &&
+		    pending->path[pending->sp - 1]->mark == 2 * round + 1)
+			pending->sp--;
+	}
+	return 1;
+}
+
+static void push(struct machine *machine, struct node *root,
+		 struct term **term)
+{
+	if (machine->count == machine->size) {
+		machine->size = machine->size ? 2 * machine->size : 16;
+		// visible to the collector, the roots keep the net alive
+		struct pending *pending = ctx_alloc(
+			machine->ctx, machine->size * sizeof(*pending));
+		if (machine->count)
+			memcpy(pending, machine->pending,
+			       machine->count * sizeof(*pending));
+		machine->pending = pending;
+	}
+	struct pending *pending = &machine->pending[machine->count++];
+	pending->size = 16;
+	pending->path = xrealloc(0, pending->size * sizeof(*pending->path));
+	pending->path[0] = root;
+	pending->sp = 1;
+	pending->term = term;
+	pending->done = 0;
+}
+
+// the auxiliary ports of the head get new roots, the variables of the
+// abstractions are connected to new variable nodes
+static struct port unplug(struct node *node, int slot, struct node *plug)
+{
+	struct port p = node->peer[slot];
+	if (p.node == node)
+		p = port(plug, 0);
+	return p;
+}
+
+// the finished root is replaced by the roots of its subterms, the last one
+// pushed is read back first, returns 0 if the net is invalid
+static int unfold(struct machine *machine, int i)
+{
+	struct ctx *ctx = machine->ctx;
+	struct node *node = machine->pending[i].path[0]->peer[0].node;
+	struct term **term = machine->pending[i].term;
+	free(machine->pending[i].path);
+	machine->pending[i] = machine->pending[--machine->count];
+
+	struct node *lhs = node_new(machine, ROOT, 0);
+	struct node *rhs = node_new(machine, ROOT, 0);
+	switch (node->type) {
+	case LAMBDA:;
+		int x = ctx_name(ctx);
+		struct node *var = node_new(machine, VARIABLE, x);
+		struct port body = unplug(node, 1, var);
+		struct port bound = unplug(node, 2, lhs);
+		link(port(lhs, 0), body);
+		link(port(var, 0), bound);
+		if (machine->speculate && active(var))
+			append(&machine->active, var, machine->round);
+		*term = output_term(ctx, ABS);
+		(*term)->u.abs.name = x;
+		push(machine, lhs, &(*term)->u.abs.term);
+		return 1;
+	case NEUTRAL:
+		link(port(lhs, 0), node->peer[1]);
+		link(port(rhs, 0), node->peer[2]);
+		*term = output_term(ctx, APP);
+		push(machine, rhs, &(*term)->u.app.rhs);
+		push(machine, lhs, &(*term)->u.app.lhs);
+		return 1;
+	case VARIABLE:
+		*term = output_term(ctx, VAR);
+		(*term)->u.var.name = node->level;
+		(*term)->u.var.type = BARENDREGT_VARIABLE;
+		return 1;
+	default:
+		fprintf(stderr, "Invalid node type %d\n", node->type);
+		return 0;
+	}
+}
+
+// the pending roots are read back one after another, with a pool all of them
+// go through parallel rounds as long as there are several or pairs may be
+// reduced speculatively -- the normal form stays the same, but the
+// transitions don't: rounds of several roots don't merge operators on their
+// walks, and a speculation may reduce pairs the read back never needs
+static struct term *read_back(struct machine *machine, struct node *root)
+{
+	struct ctx *ctx = machine->ctx;
+	struct term *res = 0;
+	push(machine, root, &res);
+	int ok = 1;
+	while (ok && machine->count) {
+		int first = machine->count - 1;
+		if (ctx->pool && (machine->count > 1 || machine->speculate)) {
+			ok = parallel(machine);
+			first = 0;
+		} else {
+			ok = head(machine, &machine->pending[first]);
+			machine->pending[first].done = ok;
+		}
+		for (int i = machine->count - 1; ok && i >= first; i--)
+			if (machine->pending[i].done)
+				ok = unfold(machine, i);
+	}
+	for (int i = 0; i < machine->count; i++)
+		free(machine->pending[i].path);
+	return ok ? res : 0;
+}
+
+// returns 0 if the budget is exceeded or the net is invalid, ctx->exceeded
+// tells which limit
+struct term *net(struct ctx *ctx, struct term *term,
+		 void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	struct machine machine = { 0 };
+	machine.ctx = ctx;
+	machine.callback = callback;
+	machine.data = data;
+	machine.speculate = ctx->pool ? ctx->speculate : 0;
+
+	struct node *root = node_new(&machine, ROOT, 0);
+	link(port(root, 0), translate(&machine, term, 0, 0));
+	struct term *res = machine.invalid ? 0 : read_back(&machine, root);
+	free(machine.pairs.pair);
+	free(machine.active.pair);
+	free(machine.buffer[0]);
+	free(machine.buffer[1]);
+	return res;
+}
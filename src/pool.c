@@ -0,0 +1,232 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// work-stealing thread pool
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <pool.h>
+#include <ctx.h>
+#include <gc.h>
+
+struct task {
+	void (*run)(void *);
+	void *data;
+};
+
+// owner pushes/pops at the tail, thieves take from the head
+struct deque {
+	pthread_mutex_t lock;
+	struct task *tasks;
+	size_t size;
+	size_t head;
+	size_t tail;
+};
+
+struct worker {
+	struct pool *pool;
+	struct deque deque;
+	pthread_t thread;
+	unsigned seed;
+};
+
+struct pool {
+	int workers;
+	struct worker *worker;
+	unsigned next; // round-robin target of external submissions
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	size_t pending; // submitted but not yet started
+	size_t active; // currently running
+	int stop;
+};
+
+static __thread struct worker *current = 0;
+
+static void deque_push(struct deque *deque, struct task task)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail - deque->head == deque->size) {
+		size_t size = deque->size ? 2 * deque->size : 64;
+		struct task *tasks = xcalloc(size, sizeof(*tasks));
+		for (size_t i = deque->head; i < deque->tail; i++)
+			tasks[i - deque->head] =
+				deque->tasks[i % deque->size];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->tail -= deque->head;
+		deque->head = 0;
+		deque->size = size;
+	}
+	deque->tasks[deque->tail++ % deque->size] = task;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static int deque_pop(struct deque *deque, struct task *task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail != deque->head) {
+		*task = deque->tasks[--deque->tail % deque->size];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int deque_steal(struct deque *deque, struct task *task)
+{
+	int found = 0;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail != deque->head) {
+		*task = deque->tasks[deque->head++ % deque->size];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static int find_task(struct pool *pool, struct worker *self, struct task *task)
+{
+	if (deque_pop(&self->deque, task))
+		return 1;
+
+	// random victim to avoid convoys on the first worker
+	self->seed = self->seed * 1103515245 + 12345;
+	int start = (self->seed >> 16) % pool->workers;
+	for (int i = 0; i < pool->workers; i++) {
+		struct worker *victim =
+			&pool->worker[(start + i) % pool->workers];
+		if (victim != self && deque_steal(&victim->deque, task))
+			return 1;
+	}
+	return 0;
+}
+
+static int run_task(struct pool *pool, struct worker *self)
+{
+	struct task task;
+	if (!find_task(pool, self, &task))
+		return 0;
+	__atomic_add_fetch(&pool->active, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+	task.run(task.data);
+
+	pthread_mutex_lock(&pool->lock);
+	if (!__atomic_sub_fetch(&pool->active, 1, __ATOMIC_RELAXED) &&
+	    !__atomic_load_n(&pool->pending, __ATOMIC_RELAXED))
+		pthread_cond_broadcast(&pool->idle);
+	pthread_mutex_unlock(&pool->lock);
+	return 1;
+}
+
+static void *worker_loop(void *data)
+{
+	struct worker *self = data;
+	struct pool *pool = self->pool;
+	current = self;
+
+	while (1) {
+		if (run_task(pool, self))
+			continue;
+
+		pthread_mutex_lock(&pool->lock);
+		while (!__atomic_load_n(&pool->pending, __ATOMIC_RELAXED) &&
+		       !pool->stop)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		int done = pool->stop &&
+			   !__atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&pool->lock);
+		if (done)
+			break;
+	}
+
+	current = 0;
+	return 0;
+}
+
+struct pool *pool_new(int workers)
+{
+	struct pool *pool = xcalloc(1, sizeof(*pool));
+	pool->workers = workers > 0 ? workers : 1;
+	pool->worker = xcalloc(pool->workers, sizeof(*pool->worker));
+	pthread_mutex_init(&pool->lock, 0);
+	pthread_cond_init(&pool->wake, 0);
+	pthread_cond_init(&pool->idle, 0);
+
+	for (int i = 0; i < pool->workers; i++) {
+		struct worker *worker = &pool->worker[i];
+		worker->pool = pool;
+		worker->seed = i + 1;
+		pthread_mutex_init(&worker->deque.lock, 0);
+	}
+	for (int i = 0; i < pool->workers; i++) {
+		struct worker *worker = &pool->worker[i];
+		if (pthread_create(&worker->thread, 0, worker_loop, worker)) {
+			fprintf(stderr, "Can't create worker thread\n");
+			abort();
+		}
+	}
+	return pool;
+}
+
+// tasks submitted by a worker go to its own deque, others are distributed
+void pool_submit(struct pool *pool, void (*run)(void *), void *data)
+{
+	struct task task = { .run = run, .data = data };
+	struct worker *target = current;
+	if (!target || target->pool != pool) {
+		unsigned next =
+			__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		target = &pool->worker[next % pool->workers];
+	}
+	__atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+	deque_push(&target->deque, task);
+
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// waits until all submitted tasks, including the ones they submitted, are done
+void pool_wait(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (__atomic_load_n(&pool->active, __ATOMIC_RELAXED) ||
+	       __atomic_load_n(&pool->pending, __ATOMIC_RELAXED))
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+size_t pool_pending(struct pool *pool)
+{
+	return __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+}
+
+int pool_workers(struct pool *pool)
+{
+	return pool->workers;
+}
+
+// waits for all submitted tasks to finish
+void pool_destroy(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->workers; i++)
+		pthread_join(pool->worker[i].thread, 0);
+	for (int i = 0; i < pool->workers; i++) {
+		pthread_mutex_destroy(&pool->worker[i].deque.lock);
+		free(pool->worker[i].deque.tasks);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->idle);
+	free(pool->worker);
+	free(pool);
+}
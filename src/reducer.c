@@ -4,9 +4,20 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <sched.h>
 
 #include <reducer.h>
+#include <ctx.h>
+#include <pool.h>
+#include <remote.h>
+#include <checkpoint.h>
+#include <fireball.h>
+#include <crumble.h>
+#include <net.h>
+#include <vm.h>
+#include <lift.h>
 #include <murmur3.h>
 #include <store.h>
 #include <term.h>
@@ -26,8 +37,11 @@ struct closure {
 	struct store *store;
 };
 
+typedef enum { TODO, RUNNING, DONE } box_state;
+
 struct box {
-	enum { TODO, DONE } state;
+	box_state state; // RUNNING: claimed by a worker, only in parallel mode
+	int once; // bound to a binder that's used once, see LINEAR
 	struct term *term;
 };
 
@@ -36,6 +50,16 @@ struct cache {
 	struct term *term;
 };
 
+// normal form of a subterm that's reduced by another worker
+struct future {
+	struct ctx *root;
+	struct term *term;
+	struct store *store;
+	struct term *result;
+	int claimed;
+	int remote; // arguments, bodies are usually the rest of the term
+};
+
 struct conf {
 	enum { ECONF, CCONF } type;
 	union {
@@ -43,6 +67,8 @@ struct conf {
 			struct term *term;
 			struct store *store;
 			struct stack *stack;
+			struct box *probe; // of the variable term if known
+			int spine; // the term is the function of an application
 		} econf; // blue
 
 		struct { // computed
@@ -52,15 +78,15 @@ struct conf {
 	} u;
 };
 
-static int name_generator(void)
-{
-	static int current = 0x181202;
-	return current++;
-}
+static struct term *normalize(struct ctx *ctx, struct term *term,
+			      struct store *store,
+			      void (*callback)(int, char, void *), void *data);
+static void speculate(struct ctx *ctx, struct box *box);
 
-static struct stack *stack_push(struct stack *stack, void *data)
+static struct stack *stack_push(struct ctx *ctx, struct stack *stack,
+				void *data)
 {
-	struct stack *new = GC_malloc(sizeof(*new));
+	struct stack *new = ctx_alloc(ctx, sizeof(*new));
 	new->data = data;
 	new->next = stack;
 	return new;
@@ -79,6 +105,8 @@ static void econf(struct conf *conf, struct term *term, struct store *store,
 	conf->u.econf.term = term;
 	conf->u.econf.store = store;
 	conf->u.econf.stack = stack;
+	conf->u.econf.probe = 0;
+	conf->u.econf.spine = 0;
 }
 
 static void cconf(struct conf *conf, struct stack *stack, struct term *term)
@@ -88,73 +116,582 @@ static void cconf(struct conf *conf, struct stack *stack, struct term *term)
 	conf->u.cconf.term = term;
 }
 
-static int transition_1(struct term **term, struct store **store,
-			struct stack **stack)
+// normal forms in boxes are already part of the result, so every further use
+// gets its own copy such that the result stays a tree owned by the caller
+static struct term *box_term(struct ctx *ctx, struct box *box)
+{
+	switch (box->term->type) {
+	case ABS:
+	case APP:
+	case VAR:
+	case FUTURE:;
+		struct ctx *root = ctx->parent ? ctx->parent : ctx;
+		if (root->limit.output) // copies may grow exponentially
+			ctx->fuel = 1;
+		return copy_term(ctx, box->term);
+	default:
+		return box->term;
+	}
+}
+
+static void ignore(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
+// tasks of worker processes have to be closed: the boxes of the environment
+// become let bindings and the variables of the surrounding strong reduction
+// become abstractions around the task
+struct shipment {
+	struct ctx *ctx;
+	struct shipped {
+		struct box *box;
+		int name; // 0 while the box itself is shipped
+	} *boxes;
+	size_t size, count;
+	struct term *lets, **hole; // innermost binding last
+	int *frees;
+	size_t nfrees;
+	int *bound; // abstractions on the path, from base in the current closure
+	size_t depth, base;
+};
+
+static void *ship_grow(void *ptr, size_t count, size_t size)
+{
+	if (count && (count < 8 || (count & (count - 1))))
+		return ptr;
+	return xrealloc(ptr, (count ? 2 * count : 8) * size);
+}
+
+static size_t shipped_slot(struct shipment *shipment, struct box *box)
+{
+	size_t i = ((uintptr_t)box >> 4) & (shipment->size - 1);
+	while (shipment->boxes[i].box && shipment->boxes[i].box != box)
+		i = (i + 1) & (shipment->size - 1);
+	return i;
+}
+
+static void shipped_add(struct shipment *shipment, struct box *box)
+{
+	if (2 * (shipment->count + 1) > shipment->size) {
+		struct shipment old = *shipment;
+		shipment->size = old.size ? 2 * old.size : 64;
+		shipment->boxes =
+			xcalloc(shipment->size, sizeof(*shipment->boxes));
+		for (size_t i = 0; i < old.size; i++)
+			if (old.boxes[i].box)
+				shipment->boxes[shipped_slot(
+					shipment, old.boxes[i].box)] =
+					old.boxes[i];
+		free(old.boxes);
+	}
+	struct shipped *shipped =
+		&shipment->boxes[shipped_slot(shipment, box)];
+	shipped->box = box;
+	shipped->name = 0;
+	shipment->count++;
+}
+
+static struct term *ship_var(struct shipment *shipment, int name)
+{
+	struct term *var = alloc_term(shipment->ctx, VAR);
+	var->u.var.name = name;
+	var->u.var.type = BARENDREGT_VARIABLE;
+	return var;
+}
+
+static struct term *ship_free(struct shipment *shipment, int name)
+{
+	size_t i = 0;
+	while (i < shipment->nfrees && shipment->frees[i] != name)
+		i++;
+	if (i == shipment->nfrees) {
+		shipment->frees = ship_grow(shipment->frees, shipment->nfrees,
+					    sizeof(int));
+		shipment->frees[shipment->nfrees++] = name;
+	}
+	return ship_var(shipment, name);
+}
+
+static struct term *ship_term(struct shipment *shipment, struct term *term,
+			      struct store *store);
+
+// terms of closures and boxes can't see the abstractions around them
+static struct term *ship_scoped(struct shipment *shipment, struct term *term,
+				struct store *store)
+{
+	size_t base = shipment->base;
+	shipment->base = shipment->depth;
+	struct term *ret = ship_term(shipment, term, store);
+	shipment->base = base;
+	return ret;
+}
+
+// boxes that are evaluated right now can't be shipped
+static struct term *ship_box(struct shipment *shipment, struct box *box)
+{
+	box_state state = __atomic_load_n(&box->state, __ATOMIC_ACQUIRE);
+	struct term *term = box->term;
+	if (state == RUNNING || !term ||
+	    (state == TODO && term->type != CLOSURE))
+		return 0;
+	if (state == DONE && term->type == VAR)
+		return ship_scoped(shipment, term, 0);
+
+	if (shipment->size) {
+		struct shipped *shipped =
+			&shipment->boxes[shipped_slot(shipment, box)];
+		if (shipped->box)
+			return shipped->name ? ship_var(shipment, shipped->name) :
+					       0;
+	}
+
+	shipped_add(shipment, box);
+	struct term *value =
+		term->type == CLOSURE ?
+			ship_scoped(shipment,
+				    ((struct closure *)term->u.other)->term,
+				    ((struct closure *)term->u.other)->store) :
+			ship_scoped(shipment, term, 0);
+	if (!value)
+		return 0;
+
+	int name = ctx_name(shipment->ctx);
+	shipment->boxes[shipped_slot(shipment, box)].name = name;
+
+	struct term *let = alloc_term(shipment->ctx, APP);
+	let->u.app.lhs = alloc_term(shipment->ctx, ABS);
+	let->u.app.lhs->u.abs.name = name;
+	let->u.app.rhs = value;
+	*shipment->hole = let;
+	shipment->hole = &let->u.app.lhs->u.abs.term;
+	return ship_var(shipment, name);
+}
+
+static struct term *ship_term(struct shipment *shipment, struct term *term,
+			      struct store *store)
+{
+	switch (term->type) {
+	case ABS:
+		shipment->bound = ship_grow(shipment->bound, shipment->depth,
+					    sizeof(int));
+		shipment->bound[shipment->depth++] = term->u.abs.name;
+		struct term *body = ship_term(shipment, term->u.abs.term, store);
+		shipment->depth--;
+		if (!body)
+			return 0;
+		struct term *abs = alloc_term(shipment->ctx, ABS);
+		abs->u.abs.name = term->u.abs.name;
+		abs->u.abs.term = body;
+		return abs;
+	case APP:;
+		struct term *lhs = ship_term(shipment, term->u.app.lhs, store);
+		struct term *rhs =
+			lhs ? ship_term(shipment, term->u.app.rhs, store) : 0;
+		if (!rhs)
+			return 0;
+		struct term *app = alloc_term(shipment->ctx, APP);
+		app->u.app.lhs = lhs;
+		app->u.app.rhs = rhs;
+		return app;
+	case VAR:
+		for (size_t i = shipment->depth; i > shipment->base; i--)
+			if (shipment->bound[i - 1] == term->u.var.name)
+				return ship_var(shipment, term->u.var.name);
+		struct box *box =
+			store ? store_get(store, &term->u.var.name, 0) : 0;
+		return box ? ship_box(shipment, box) :
+			     ship_free(shipment, term->u.var.name);
+	case CACHE:;
+		struct cache *cache = term->u.other;
+		if (cache->term->type != CLOSURE)
+			return 0;
+		struct closure *closure = cache->term->u.other;
+		return ship_scoped(shipment, closure->term, closure->store);
+	default: // futures aren't known yet
+		return 0;
+	}
+}
+
+// normalizes a term by a worker process, 0 if no worker is idle or if the
+// term can't be shipped yet
+static struct term *remote_normalize(struct ctx *ctx, struct term *term,
+				     struct store *store)
+{
+	int connection = remote_acquire(ctx->remote);
+	if (connection < 0)
+		return 0;
+
+	struct shipment shipment = { 0 };
+	shipment.ctx = ctx;
+	shipment.hole = &shipment.lets;
+	struct term *task = ship_term(&shipment, term, store);
+	char *blc = 0;
+	if (task) {
+		*shipment.hole = task;
+		task = shipment.lets;
+		for (size_t i = shipment.nfrees; i > 0; i--) {
+			struct term *abs = alloc_term(ctx, ABS);
+			abs->u.abs.name = shipment.frees[i - 1];
+			abs->u.abs.term = task;
+			task = abs;
+		}
+		blc = remote_blc(task);
+	}
+
+	struct term *ret = 0;
+	char *line = blc ? remote_call(ctx->remote, connection, blc) : 0;
+	if (!blc)
+		remote_release(ctx->remote, connection);
+	if (line)
+		ret = remote_term(ctx, line, shipment.frees, shipment.nfrees);
+	if (ret)
+		ctx->stats.shipped++;
+
+	free(line);
+	free(blc);
+	free(shipment.boxes);
+	free(shipment.frees);
+	free(shipment.bound);
+	return ret;
+}
+
+// the task of a future, uncollectable as the pool's deques are invisible to
+// the garbage collector, it keeps the future alive until it has run even if
+// the term forking it was abandoned because of the budget
+struct task {
+	struct future *future;
+};
+
+static void future_run(void *data)
+{
+	struct task *task = data;
+	struct future *future = task->future;
+	struct ctx ctx;
+	ctx_child(&ctx, future->root);
+	struct term *result =
+		ctx.remote && future->remote ?
+			remote_normalize(&ctx, future->term, future->store) :
+			0;
+	future->result = result ? result :
+				  normalize(&ctx, future->term, future->store,
+					    ignore, 0);
+	ctx_merge(&ctx);
+	GC_free(task);
+}
+
+static struct term *fork_normalize(struct ctx *ctx, struct term *term,
+				   struct store *store, int remote)
+{
+	struct future *future = ctx_alloc(ctx, sizeof(*future));
+	future->root = ctx->parent;
+	future->term = term;
+	future->store = store;
+	future->result = 0;
+	future->claimed = 0;
+	future->remote = remote;
+
+	struct task *task = GC_malloc_uncollectable(sizeof(*task));
+	if (!task) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	task->future = future;
+
+	struct term *ret = alloc_term(ctx, FUTURE);
+	ret->u.other = future;
+	pool_submit(ctx->pool, future_run, task);
+	return ret;
+}
+
+// child contexts without a pool only evaluate boxes speculatively
+static int speculative(struct ctx *ctx)
+{
+	return ctx->parent && !ctx->pool;
+}
+
+static int box_claim(struct box *box)
+{
+	box_state todo = TODO;
+	return __atomic_compare_exchange_n(&box->state, &todo, RUNNING, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// returns TODO if the caller has to evaluate the box, waits for other
+// workers evaluating it in concurrent reductions (blackholing)
+// speculative evaluations don't wait but give up on RUNNING boxes, which may
+// also be released to TODO again by a cancelled speculation, all evaluations
+// give up once the budget is exceeded
+static box_state box_force(struct ctx *ctx, struct box *box)
+{
+	box_state state = __atomic_load_n(&box->state, __ATOMIC_ACQUIRE);
+	if (!ctx->parent || state == DONE)
+		return state;
+
+	while (1) {
+		if (state == TODO && box_claim(box))
+			return TODO;
+		if (state == RUNNING && speculative(ctx))
+			return RUNNING;
+		if (state == DONE)
+			return DONE;
+		if (ctx_exceeded(ctx)) // the worker may have stopped as well
+			return RUNNING;
+		sched_yield();
+		state = __atomic_load_n(&box->state, __ATOMIC_ACQUIRE);
+	}
+}
+
+static void box_done(struct box *box, struct term *term)
+{
+	box->term = term;
+	__atomic_store_n(&box->state, DONE, __ATOMIC_RELEASE);
+}
+
+// trivial arguments are not worth a task, the box of a variable argument is
+// returned in probe so the sequential (9) doesn't look it up again
+static int fork_worthy(struct closure *closure, struct box **probe)
+{
+	if (closure->term->type != VAR)
+		return 1;
+	struct box *box =
+		store_get(closure->store, &closure->term->u.var.name, 0);
+	*probe = box;
+	return box && (__atomic_load_n(&box->state, __ATOMIC_ACQUIRE) != DONE ||
+		       box->term->type != VAR);
+}
+
+// maximum number of arguments bound by (12), of bindings trimmed on the stack
+#define NARY 64
+
+// free variables of a term as keys of the stores, sorted by name
+struct free_vars {
+	size_t count;
+	int *names[]; // of the binding abstractions
+};
+
+static struct free_vars no_free_vars = { 0 };
+
+struct binders {
+	struct term *abs;
+	struct binders *next;
+};
+
+static struct free_vars *free_vars_new(struct ctx *ctx, size_t count)
+{
+	struct free_vars *vars = ctx_alloc(
+		ctx, sizeof(*vars) + count * sizeof(*vars->names));
+	vars->count = count;
+	return vars;
+}
+
+static int hash_term_equal(void *lhs, void *rhs);
+static uint32_t hash_term(void *key);
+
+// the pre-pass of TRIM, adds the free variables of every abstraction to the
+// table -- variables without binder are free in the whole term and never
+// bound in a store
+static struct free_vars *annotate(struct ctx *ctx, struct term *term,
+				  struct binders *binders,
+				  struct store **table)
+{
+	struct free_vars *vars = store_get(*table, term, 0);
+	if (vars)
+		return vars;
+
+	switch (term->type) {
+	case ABS:;
+		struct binders binder = { term, binders };
+		struct free_vars *body =
+			annotate(ctx, term->u.abs.term, &binder, table);
+		vars = body;
+		for (size_t i = 0; i < body->count; i++) {
+			if (*body->names[i] != term->u.abs.name)
+				continue;
+			vars = free_vars_new(ctx, body->count - 1);
+			memcpy(vars->names, body->names,
+			       i * sizeof(*vars->names));
+			memcpy(vars->names + i, body->names + i + 1,
+			       (body->count - i - 1) * sizeof(*vars->names));
+			break;
+		}
+		break;
+	case APP:;
+		struct free_vars *lhs =
+			annotate(ctx, term->u.app.lhs, binders, table);
+		struct free_vars *rhs =
+			annotate(ctx, term->u.app.rhs, binders, table);
+		if (term->u.app.rhs->type != ABS) // the term of a thunk
+			*table = store_set(*table, term->u.app.rhs, rhs, 0);
+		vars = free_vars_new(ctx, lhs->count + rhs->count);
+		size_t i = 0, j = 0, k = 0;
+		while (i < lhs->count || j < rhs->count) {
+			if (j == rhs->count ||
+			    (i < lhs->count && *lhs->names[i] < *rhs->names[j]))
+				vars->names[k++] = lhs->names[i++];
+			else if (i == lhs->count ||
+				 *rhs->names[j] < *lhs->names[i])
+				vars->names[k++] = rhs->names[j++];
+			else
+				vars->names[k++] = lhs->names[i++], j++;
+		}
+		vars->count = k;
+		if (k == lhs->count)
+			vars = lhs;
+		else if (k == rhs->count)
+			vars = rhs;
+		break;
+	case VAR:
+		while (binders &&
+		       binders->abs->u.abs.name != term->u.var.name)
+			binders = binders->next;
+		if (!binders) {
+			vars = &no_free_vars;
+			break;
+		}
+		vars = free_vars_new(ctx, 1);
+		vars->names[0] = &binders->abs->u.abs.name;
+		break;
+	default:
+		return &no_free_vars;
+	}
+
+	if (term->type == ABS) // arguments are entered by their application
+		*table = store_set(*table, term, vars, 0);
+	return vars;
+}
+
+// the free variables of abstractions and arguments are kept by address in the
+// root context instead of the terms, reductions of parts of the term share the
+// table until reduction_finish clears it
+static void annotate_term(struct ctx *ctx, struct term *term)
+{
+	struct ctx *root = ctx->parent ? ctx->parent : ctx;
+	struct store *table =
+		__atomic_load_n(&root->free_vars, __ATOMIC_ACQUIRE);
+	if (!table)
+		table = store_new(hash_term, hash_term_equal);
+	annotate(ctx, term, 0, &table);
+	__atomic_store_n(&root->free_vars, table, __ATOMIC_RELEASE);
+}
+
+static int hash_var_equal(void *lhs, void *rhs);
+static uint32_t hash_var(void *key);
+
+// the store of the closure of an abstraction or an argument, without the
+// bindings its evaluation can't reach, so their boxes can be collected while
+// the closure lives on as a value or an unforced thunk; unannotated terms and
+// stores that would lose less than half of their bindings stay whole, which
+// bounds the rebuilds by the bindings they drop
+static struct store *trim(struct ctx *ctx, struct term *term,
+			  struct store *store)
+{
+	if (!(ctx->optimize & TRIM) || store_length(store) < 2)
+		return store;
+	struct ctx *root = ctx->parent ? ctx->parent : ctx;
+	struct store *table =
+		__atomic_load_n(&root->free_vars, __ATOMIC_ACQUIRE);
+	struct free_vars *vars = table ? store_get(table, term, 0) : 0;
+	if (!vars || 2 * vars->count > store_length(store))
+		return store;
+
+	STORE_KEY_T keys_buffer[NARY];
+	STORE_VALUE_T values_buffer[NARY];
+	STORE_KEY_T *keys = keys_buffer;
+	STORE_VALUE_T *values = values_buffer;
+	if (vars->count > NARY) {
+		keys = ctx_alloc(ctx, vars->count * sizeof(*keys));
+		values = ctx_alloc(ctx, vars->count * sizeof(*values));
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < vars->count; i++) {
+		int found = 0;
+		values[count] = store_get(store, vars->names[i], &found);
+		if (found)
+			keys[count++] = vars->names[i];
+	}
+	return store_set_all(store_new(hash_var, hash_var_equal), keys,
+			     values, count);
+}
+
+// frame of an argument waiting for its function
+static struct term *app_frame(struct ctx *ctx, struct term *rhs,
+			      struct store *store)
 {
-	struct closure *closure = GC_malloc(sizeof(*closure));
-	closure->term = (*term)->u.app.rhs;
-	closure->store = *store;
+	struct closure *closure = ctx_alloc(ctx, sizeof(*closure));
+	closure->term = rhs;
+	closure->store = trim(ctx, rhs, store);
 
-	struct term *app = new_term(APP);
-	app->u.app.lhs = new_term(VAR);
-	app->u.app.rhs = new_term(CLOSURE);
+	struct term *app = alloc_term(ctx, APP);
+	app->u.app.lhs = alloc_term(ctx, VAR);
+	app->u.app.rhs = alloc_term(ctx, CLOSURE);
 	app->u.app.rhs->u.other = closure;
+	return app;
+}
+
+static int transition_1(struct ctx *ctx, struct term **term,
+			struct store **store, struct stack **stack)
+{
+	struct term *app = app_frame(ctx, (*term)->u.app.rhs, *store);
 
 	*term = (*term)->u.app.lhs;
 	*store = *store;
-	*stack = stack_push(*stack, app);
+	*stack = stack_push(ctx, *stack, app);
 
 	return 0;
 }
 
-static int transition_2(struct stack **stack, struct term **term,
-			struct store *store)
+static int transition_2(struct ctx *ctx, struct stack **stack,
+			struct term **term, struct store *store)
 {
-	struct box *box = GC_malloc(sizeof(*box));
+	struct box *box = ctx_alloc(ctx, sizeof(*box));
 	box->state = TODO;
 	box->term = 0;
 
-	struct closure *closure = GC_malloc(sizeof(*closure));
+	struct closure *closure = ctx_alloc(ctx, sizeof(*closure));
 	closure->term = *term;
-	closure->store = store;
+	closure->store = trim(ctx, *term, store);
 
-	struct cache *cache = GC_malloc(sizeof(*cache));
+	struct cache *cache = ctx_alloc(ctx, sizeof(*cache));
 	cache->box = box;
-	cache->term = new_term(CLOSURE);
+	cache->term = alloc_term(ctx, CLOSURE);
 	cache->term->u.other = closure;
 
 	*stack = *stack;
-	*term = new_term(CACHE);
+	*term = alloc_term(ctx, CACHE);
 	(*term)->u.other = cache;
 
 	return 0;
 }
 
-static int transition_3(struct term **term, struct store **store,
-			struct stack **stack, struct box *box)
+static int transition_3(struct ctx *ctx, struct term **term,
+			struct store **store, struct stack **stack,
+			struct box *box)
 {
 	assert(box->term->type == CLOSURE);
 
-	struct cache *cache = GC_malloc(sizeof(*cache));
+	struct cache *cache = ctx_alloc(ctx, sizeof(*cache));
 	cache->box = box;
-	cache->term = new_term(VAR);
+	cache->term = alloc_term(ctx, VAR);
 
-	struct term *cache_term = new_term(CACHE);
+	struct term *cache_term = alloc_term(ctx, CACHE);
 	cache_term->u.other = cache;
 
 	struct closure *closure = box->term->u.other;
 	*term = closure->term;
 	*store = closure->store;
-	*stack = stack_push(*stack, cache_term);
+	*stack = stack_push(ctx, *stack, cache_term);
 
 	return 0;
 }
 
-static int transition_4(struct stack **stack, struct term **term,
-			struct box *box)
+static int transition_4(struct ctx *ctx, struct stack **stack,
+			struct term **term, struct box *box)
 {
 	*stack = *stack;
-	*term = box->term;
+	*term = box_term(ctx, box);
 
 	return 0;
 }
@@ -165,8 +702,7 @@ static int transition_5(struct stack **stack, struct term **term,
 	struct cache *cache = peek_term->u.other;
 	struct box *box = cache->box;
 
-	box->state = DONE;
-	box->term = *term;
+	box_done(box, *term);
 
 	*stack = stack_next(*stack);
 	*term = *term;
@@ -174,83 +710,245 @@ static int transition_5(struct stack **stack, struct term **term,
 	return 0;
 }
 
-static int transition_6(struct term **term, struct store **store,
-			struct stack **stack, struct term *peek_term,
-			struct closure *closure)
+struct usage {
+	struct term *abs;
+	int depth; // of the abstractions around its body
+	int count;
+	int shared;
+	struct usage *next;
+};
+
+// the pre-pass of LINEAR: a binder is used once if it occurs at most once and
+// not below another abstraction of its body, which may be entered repeatedly
+static void analyze(struct term *term, struct usage *binders, int depth)
 {
-	struct box *box = GC_malloc(sizeof(*box));
-	box->state = TODO;
-	box->term = peek_term->u.app.rhs;
+	switch (term->type) {
+	case ABS:;
+		struct usage binder = { term, depth + 1, 0, 0, binders };
+		analyze(term->u.abs.term, &binder, depth + 1);
+		int usage = binder.shared || binder.count > 1 ? SHARED :
+			    binder.count			 ? USED_ONCE :
+								   UNUSED;
+		__atomic_store_n(&term->u.abs.usage, usage, __ATOMIC_RELAXED);
+		break;
+	case APP:
+		analyze(term->u.app.lhs, binders, depth);
+		analyze(term->u.app.rhs, binders, depth);
+		break;
+	case VAR:
+		while (binders && binders->abs->u.abs.name != term->u.var.name)
+			binders = binders->next;
+		if (binders && binders->depth != depth)
+			binders->shared = 1;
+		else if (binders)
+			binders->count++;
+		break;
+	default:
+		break;
+	}
+}
 
-	*term = closure->term->u.abs.term;
-	*store = store_set(closure->store, &closure->term->u.abs.name, box, 0);
-	*stack = stack_next(*stack);
+// terms that were not analyzed are shared
+static int binder_usage(struct ctx *ctx, struct term *abs)
+{
+	if (!(ctx->optimize & LINEAR))
+		return SHARED;
+	int usage = __atomic_load_n(&abs->u.abs.usage, __ATOMIC_RELAXED);
+	return usage == UNANALYZED ? SHARED : usage;
+}
+
+// atomic arguments need no thunk: variables share the box they are bound to,
+// abstractions are bound to the cache (2) would update the thunk with
+// returns 0 for other arguments
+static struct box *atomic_box(struct ctx *ctx, struct term *term,
+			      struct store *store)
+{
+	if (term->type == VAR) { // single uses must not be shared
+		struct box *box = store_get(store, &term->u.var.name, 0);
+		return box && !box->once ? box : 0;
+	}
+	if (term->type != ABS)
+		return 0;
+
+	struct stack *stack = 0;
+	struct box *box = ctx_alloc(ctx, sizeof(*box));
+	box->state = DONE;
+	transition_2(ctx, &stack, &term, store);
+	box->term = term;
+	return box;
+}
+
+// the frame of an argument pushed by (1) or (12)
+static int argument_frame(struct term *frame)
+{
+	return frame && frame->type == APP && frame->u.app.lhs->type == VAR &&
+	       !frame->u.app.lhs->u.var.name &&
+	       frame->u.app.rhs->type == CLOSURE;
+}
+
+// with NARY_BETA, the argument frames on top of the stack are bound at once
+// as long as the body is again an abstraction, so dynamically created
+// redexes of curried functions are reduced like those of (12)
+static int transition_6(struct ctx *ctx, struct term **term,
+			struct store **store, struct stack **stack,
+			struct term *peek_term, struct closure *closure)
+{
+	STORE_KEY_T keys[NARY];
+	STORE_VALUE_T values[NARY];
+	int count = 0;
+	int n = 0;
+	struct term *abs = closure->term;
+	do {
+		int usage = binder_usage(ctx, abs);
+		if (usage != UNUSED) { // otherwise the argument is never needed
+			struct closure *argument =
+				peek_term->u.app.rhs->u.other;
+			struct box *box =
+				ctx->optimize & ATOMIC ?
+					atomic_box(ctx, argument->term,
+						   argument->store) :
+					0;
+			if (!box) {
+				box = ctx_alloc(ctx, sizeof(*box));
+				box->state = TODO;
+				box->once = usage == USED_ONCE;
+				box->term = peek_term->u.app.rhs;
+				if (ctx->pool)
+					speculate(ctx, box);
+			}
+			keys[count] = &abs->u.abs.name;
+			values[count++] = box;
+		}
+
+		abs = abs->u.abs.term;
+		*stack = stack_next(*stack);
+		peek_term = *stack ? (*stack)->data : 0;
+	} while (ctx->optimize & NARY_BETA && ++n < NARY && abs->type == ABS &&
+		 argument_frame(peek_term));
+
+	*term = abs;
+	if (count > 1)
+		*store = store_set_all(closure->store, keys, values, count);
+	else if (count)
+		*store = store_set(closure->store, keys[0], values[0], 0);
+	else
+		*store = closure->store;
 
 	return 0;
 }
 
-static int transition_7(struct term **term, struct store **store,
-			struct stack **stack, struct box *box,
-			struct closure *closure)
+static int transition_7(struct ctx *ctx, struct term **term,
+			struct store **store, struct stack **stack,
+			struct box *box, struct closure *closure)
 {
-	int x = name_generator();
+	int x = ctx_name(ctx);
 
-	struct box *var_box = GC_malloc(sizeof(*var_box));
+	struct box *var_box = ctx_alloc(ctx, sizeof(*var_box));
 	var_box->state = DONE;
-	var_box->term = new_term(VAR);
+	var_box->term = alloc_term(ctx, VAR);
 	var_box->term->u.var.name = x;
 
-	struct cache *cache = GC_malloc(sizeof(*cache));
+	struct cache *cache = ctx_alloc(ctx, sizeof(*cache));
 	cache->box = box;
-	cache->term = new_term(VAR);
+	cache->term = alloc_term(ctx, VAR);
 
-	struct term *cache_term = new_term(CACHE);
+	struct term *cache_term = alloc_term(ctx, CACHE);
 	cache_term->u.other = cache;
 
-	struct term *abs = new_term(ABS);
+	struct term *abs = alloc_term(ctx, ABS);
 	abs->u.abs.name = x;
-	abs->u.abs.term = new_term(VAR);
+	abs->u.abs.term = alloc_term(ctx, VAR);
 
 	*term = closure->term->u.abs.term;
 	*store = store_set(closure->store, (void *)&closure->term->u.abs.name,
 			   var_box, 0);
-	*stack = stack_push(*stack, cache_term);
-	*stack = stack_push(*stack, abs);
+	*stack = stack_push(ctx, *stack, cache_term);
+	*stack = stack_push(ctx, *stack, abs);
 
 	return 0;
 }
 
-static int transition_8(struct stack **stack, struct term **term,
-			struct box *box)
+static int transition_8(struct ctx *ctx, struct stack **stack,
+			struct term **term, struct box *box)
 {
 	*stack = *stack;
-	*term = box->term;
+	*term = box_term(ctx, box);
 
 	return 0;
 }
 
-static int transition_9(struct term **term, struct store **store,
-			struct stack **stack, struct term *peek_term)
+static int transition_9(struct ctx *ctx, struct term **term,
+			struct store **store, struct stack **stack,
+			struct term *peek_term)
 {
 	struct closure *closure = peek_term->u.app.rhs->u.other;
 
-	struct term *app = new_term(APP);
+	struct term *app = alloc_term(ctx, APP);
 	app->u.app.lhs = *term;
-	app->u.app.rhs = new_term(VAR);
+	app->u.app.rhs = alloc_term(ctx, VAR);
 
 	*term = closure->term;
 	*store = closure->store;
-	*stack = stack_push(stack_next(*stack), app);
+	*stack = stack_push(ctx, stack_next(*stack), app);
 
 	return 0;
 }
 
-static int transition_10(struct stack **stack, struct term **term,
-			 struct term *peek_term)
+// (7) in parallel mode: the body is normalized by another worker, the box is
+// updated immediately instead of by (11) and (5)
+static int transition_7_fork(struct ctx *ctx, struct stack **stack,
+			     struct term **term, struct box *box,
+			     struct closure *closure)
 {
-	struct term *app = new_term(APP);
+	int x = ctx_name(ctx);
+
+	struct box *var_box = ctx_alloc(ctx, sizeof(*var_box));
+	var_box->state = DONE;
+	var_box->term = alloc_term(ctx, VAR);
+	var_box->term->u.var.name = x;
+
+	struct store *store = store_set(
+		closure->store, (void *)&closure->term->u.abs.name, var_box, 0);
+
+	struct term *abs = alloc_term(ctx, ABS);
+	abs->u.abs.name = x;
+	abs->u.abs.term =
+		fork_normalize(ctx, closure->term->u.abs.term, store, 0);
+	ctx->stats.output++;
+	box_done(box, abs);
+
+	*stack = *stack;
+	*term = abs;
+
+	return 0;
+}
+
+// (9) in parallel mode: the argument is normalized by another worker, maybe
+// in another process, the application is completed immediately instead of by (10)
+static int transition_9_fork(struct ctx *ctx, struct stack **stack,
+			     struct term **term, struct term *peek_term)
+{
+	struct closure *closure = peek_term->u.app.rhs->u.other;
+
+	struct term *app = alloc_term(ctx, APP);
+	app->u.app.lhs = *term;
+	app->u.app.rhs =
+		fork_normalize(ctx, closure->term, closure->store, 1);
+	ctx->stats.output++;
+
+	*stack = stack_next(*stack);
+	*term = app;
+
+	return 0;
+}
+
+static int transition_10(struct ctx *ctx, struct stack **stack,
+			 struct term **term, struct term *peek_term)
+{
+	struct term *app = alloc_term(ctx, APP);
 	app->u.app.lhs = peek_term->u.app.lhs;
 	app->u.app.rhs = *term;
+	ctx->stats.output++;
 
 	*stack = stack_next(*stack);
 	*term = app;
@@ -258,12 +956,13 @@ static int transition_10(struct stack **stack, struct term **term,
 	return 0;
 }
 
-static int transition_11(struct stack **stack, struct term **term,
-			 struct term *peek_term)
+static int transition_11(struct ctx *ctx, struct stack **stack,
+			 struct term **term, struct term *peek_term)
 {
-	struct term *abs = new_term(ABS);
+	struct term *abs = alloc_term(ctx, ABS);
 	abs->u.abs.name = peek_term->u.abs.name;
 	abs->u.abs.term = *term;
+	ctx->stats.output++;
 
 	*stack = stack_next(*stack);
 	*term = abs;
@@ -271,7 +970,129 @@ static int transition_11(struct stack **stack, struct term **term,
 	return 0;
 }
 
-static int transition_closure(struct conf *conf, int i,
+// number of arguments an application binds to its head abstraction at once
+static int saturated(struct term *term, int max)
+{
+	int k = 0;
+	while (term->type == APP) {
+		term = term->u.app.lhs;
+		k++;
+	}
+	int n = 0;
+	while (term->type == ABS && n < k && n < max) {
+		term = term->u.abs.term;
+		n++;
+	}
+	return n;
+}
+
+// (1), (2) and (6) for the n innermost arguments of the spine, the others
+// are pushed like in (1) -- for n = 1 this fuses 1*26, the most frequent beta
+// step of tests/*.trans
+static int transition_12(struct ctx *ctx, struct term **term,
+			 struct store **store, struct stack **stack, int n)
+{
+	struct term *head = *term;
+	int k = 0;
+	while (head->type == APP) {
+		head = head->u.app.lhs;
+		k++;
+	}
+
+	struct term *spine = *term;
+	for (; k > n; k--) {
+		struct term *app = app_frame(ctx, spine->u.app.rhs, *store);
+		*stack = stack_push(ctx, *stack, app);
+		spine = spine->u.app.lhs;
+	}
+
+	struct term *args[NARY];
+	for (int j = n - 1; j >= 0; j--) {
+		args[j] = spine->u.app.rhs;
+		spine = spine->u.app.lhs;
+	}
+
+	STORE_KEY_T keys[NARY];
+	STORE_VALUE_T values[NARY];
+	int count = 0;
+	for (int j = 0; j < n; j++, head = head->u.abs.term) {
+		int usage = binder_usage(ctx, head);
+		if (usage == UNUSED)
+			continue;
+
+		struct box *box = ctx->optimize & ATOMIC ?
+					  atomic_box(ctx, args[j], *store) :
+					  0;
+		if (!box) {
+			struct closure *closure =
+				ctx_alloc(ctx, sizeof(*closure));
+			closure->term = args[j];
+			closure->store = trim(ctx, args[j], *store);
+
+			box = ctx_alloc(ctx, sizeof(*box));
+			box->state = TODO;
+			box->once = usage == USED_ONCE;
+			box->term = alloc_term(ctx, CLOSURE);
+			box->term->u.other = closure;
+			if (ctx->pool)
+				speculate(ctx, box);
+		}
+
+		keys[count] = &head->u.abs.name;
+		values[count++] = box;
+	}
+
+	*term = head;
+	*store = store_set_all(*store, keys, values, count);
+	*stack = *stack;
+
+	return 0;
+}
+
+// (3), (2) and (5) for a variable bound to an abstraction, the update frame
+// and the configuration of the abstraction are skipped
+static int transition_13(struct ctx *ctx, struct stack **stack,
+			 struct term **term, struct box *box)
+{
+	struct closure *closure = box->term->u.other;
+	*term = closure->term;
+	transition_2(ctx, stack, term, closure->store);
+	box_done(box, *term);
+
+	return 0;
+}
+
+// (3), (4) and (5) for a variable bound to a variable that is already
+// evaluated or free
+static int transition_14(struct ctx *ctx, struct stack **stack,
+			 struct term **term, struct box *box,
+			 struct box *value)
+{
+	struct closure *closure = box->term->u.other;
+	*stack = *stack;
+	*term = value ? box_term(ctx, value) : copy_term(ctx, closure->term);
+	box_done(box, *term);
+
+	return 0;
+}
+
+// (3) without the update frame, nothing reads the box of a binder that's
+// used once again -- the claim of box_force is released as no update follows
+static int transition_15(struct ctx *ctx, struct term **term,
+			 struct store **store, struct box *box)
+{
+	assert(box->term->type == CLOSURE);
+	struct closure *closure = box->term->u.other;
+	if (ctx->parent)
+		__atomic_store_n(&box->state, TODO, __ATOMIC_RELEASE);
+
+	*term = closure->term;
+	*store = closure->store;
+
+	return 0;
+}
+
+static int transition_closure(struct ctx *ctx, struct conf *conf, int i,
 			      void (*callback)(int, char, void *), void *data)
 {
 	struct term *term = conf->u.econf.term;
@@ -280,35 +1101,87 @@ static int transition_closure(struct conf *conf, int i,
 
 	int ret = 1;
 	switch (term->type) {
-	case APP: // (1)
+	case APP:
+		// the head is the same for the rest of the spine
+		if (ctx->optimize & (NARY_BETA | FUSED) &&
+		    !conf->u.econf.spine) {
+			int n = saturated(
+				term, ctx->optimize & NARY_BETA ? NARY : 1);
+			if (n > 1 || (n && ctx->optimize & FUSED)) { // (12)
+				callback(i, 'C', data);
+				ret = transition_12(ctx, &term, &store, &stack,
+						    n);
+				econf(conf, term, store, stack);
+				return ret;
+			}
+		}
+		// (1)
 		callback(i, '1', data);
-		ret = transition_1(&term, &store, &stack);
+		ret = transition_1(ctx, &term, &store, &stack);
 		econf(conf, term, store, stack);
+		conf->u.econf.spine = 1;
 		return ret;
 	case ABS: // (2)
 		callback(i, '2', data);
-		ret = transition_2(&stack, &term, store);
+		ret = transition_2(ctx, &stack, &term, store);
 		cconf(conf, stack, term);
 		return ret;
 	case VAR:;
-		struct box *box = store_get(store, &term->u.var.name, 0);
+		ctx->stats.lookups++;
+		ctx->stats.probed += !!conf->u.econf.probe;
+		struct box *box = conf->u.econf.probe ?
+					  conf->u.econf.probe :
+					  store_get(store, &term->u.var.name, 0);
 		if (!box) {
-			box = GC_malloc(sizeof(*box));
+			box = ctx_alloc(ctx, sizeof(*box));
 			box->state = DONE;
 			box->term = term;
 		}
-		if (box->state == TODO) { // (3)
+		box_state state = box_force(ctx, box);
+		if (state == TODO && box->once) { // (15)
+			callback(i, 'F', data);
+			ret = transition_15(ctx, &term, &store, box);
+			econf(conf, term, store, stack);
+			return ret;
+		}
+		struct closure *closure =
+			state == TODO && ctx->optimize & FUSED ?
+				box->term->u.other :
+				0;
+		if (closure && closure->term->type == ABS) { // (13)
+			callback(i, 'D', data);
+			ret = transition_13(ctx, &stack, &term, box);
+			cconf(conf, stack, term);
+			return ret;
+		}
+		struct box *value =
+			closure && closure->term->type == VAR ?
+				store_get(closure->store,
+					  &closure->term->u.var.name, 0) :
+				0;
+		if (closure && closure->term->type == VAR &&
+		    (!value || __atomic_load_n(&value->state,
+					       __ATOMIC_ACQUIRE) == DONE)) { // (14)
+			callback(i, 'E', data);
+			ret = transition_14(ctx, &stack, &term, box, value);
+			cconf(conf, stack, term);
+			return ret;
+		}
+		if (state == TODO) { // (3)
 			callback(i, '3', data);
-			ret = transition_3(&term, &store, &stack, box);
+			ret = transition_3(ctx, &term, &store, &stack, box);
 			econf(conf, term, store, stack);
+			conf->u.econf.probe = value;
 			return ret;
-		} else if (box->state == DONE) { // (4)
+		} else if (state == DONE) { // (4)
 			callback(i, '4', data);
-			ret = transition_4(&stack, &term, box);
+			ret = transition_4(ctx, &stack, &term, box);
 			cconf(conf, stack, term);
 			return ret;
+		} else if (state == RUNNING) { // speculation or budget gives up
+			return 1;
 		}
-		fprintf(stderr, "Invalid box state %d\n", box->state);
+		fprintf(stderr, "Invalid box state %d\n", state);
 		return 1;
 	default:
 		fprintf(stderr, "Invalid econf type %d\n", term->type);
@@ -316,7 +1189,7 @@ static int transition_closure(struct conf *conf, int i,
 	}
 }
 
-static int transition_computed(struct conf *conf, int i,
+static int transition_computed(struct ctx *ctx, struct conf *conf, int i,
 			       void (*callback)(int, char, void *), void *data)
 {
 	struct stack *stack = conf->u.cconf.stack;
@@ -326,6 +1199,7 @@ static int transition_computed(struct conf *conf, int i,
 		return 1;
 	}
 	int ret = 1;
+	struct box *probe = 0;
 	struct term *peek_term = stack->data;
 	if (peek_term && peek_term->type == CACHE) { // (5)
 		struct cache *cache = peek_term->u.other;
@@ -337,17 +1211,15 @@ static int transition_computed(struct conf *conf, int i,
 			return ret;
 		}
 	}
-	if (peek_term && peek_term->type == APP &&
-	    peek_term->u.app.lhs->type == VAR &&
-	    !peek_term->u.app.lhs->u.var.name && term->type == CACHE &&
+	if (argument_frame(peek_term) && term->type == CACHE &&
 	    ((struct cache *)term->u.other)->term->type == CLOSURE) { // (6)
 		struct closure *closure =
 			((struct cache *)term->u.other)->term->u.other;
 		if (closure->term->type == ABS) {
 			callback(i, '6', data);
 			struct store *store;
-			ret = transition_6(&term, &store, &stack, peek_term,
-					   closure);
+			ret = transition_6(ctx, &term, &store, &stack,
+					   peek_term, closure);
 			econf(conf, term, store, stack);
 			return ret;
 		}
@@ -357,36 +1229,73 @@ static int transition_computed(struct conf *conf, int i,
 		struct box *box = ((struct cache *)term->u.other)->box;
 		struct closure *closure =
 			((struct cache *)term->u.other)->term->u.other;
-		if (closure->term->type == ABS && box->state == TODO &&
+		box_state state = closure->term->type == ABS ?
+					  box_force(ctx, box) :
+					  box->state;
+		if (closure->term->type == ABS &&
+		    state == RUNNING) // speculation or budget gives up
+			return 1;
+		if (closure->term->type == ABS && state == TODO &&
+		    !box->term &&
+		    ctx->form == WEAK_HEAD_NORMAL_FORM) // body stays suspended
+			return 1;
+		if (closure->term->type == ABS && state == TODO &&
+		    !box->term && ctx->pool &&
+		    ctx->form == NORMAL_FORM) { // (7), parallel
+			callback(i, '7', data);
+			ret = transition_7_fork(ctx, &stack, &term, box,
+						closure);
+			cconf(conf, stack, term);
+			return ret;
+		}
+		if (closure->term->type == ABS && state == TODO &&
 		    !box->term) { // (7)
 			callback(i, '7', data);
 			struct store *store;
-			ret = transition_7(&term, &store, &stack, box, closure);
+			ret = transition_7(ctx, &term, &store, &stack, box,
+					   closure);
 			econf(conf, term, store, stack);
 			return ret;
 		}
-		if (closure->term->type == ABS && box->state == DONE) { // (8)
+		if (closure->term->type == ABS && state == DONE) { // (8)
 			callback(i, '8', data);
-			ret = transition_8(&stack, &term, box);
+			ret = transition_8(ctx, &stack, &term, box);
 			cconf(conf, stack, term);
 			return ret;
 		}
 	}
+	if (peek_term && peek_term->type == APP &&
+	    peek_term->u.app.lhs->type == VAR &&
+	    !peek_term->u.app.lhs->u.var.name &&
+	    peek_term->u.app.rhs->type == CLOSURE &&
+	    ctx->form != NORMAL_FORM) // arguments stay suspended
+		return 1;
+	if (peek_term && peek_term->type == APP &&
+	    peek_term->u.app.lhs->type == VAR &&
+	    !peek_term->u.app.lhs->u.var.name &&
+	    peek_term->u.app.rhs->type == CLOSURE && ctx->pool &&
+	    fork_worthy(peek_term->u.app.rhs->u.other, &probe)) { // (9), parallel
+		callback(i, '9', data);
+		ret = transition_9_fork(ctx, &stack, &term, peek_term);
+		cconf(conf, stack, term);
+		return ret;
+	}
 	if (peek_term && peek_term->type == APP &&
 	    peek_term->u.app.lhs->type == VAR &&
 	    !peek_term->u.app.lhs->u.var.name &&
 	    peek_term->u.app.rhs->type == CLOSURE) { // (9)
 		callback(i, '9', data);
 		struct store *store;
-		ret = transition_9(&term, &store, &stack, peek_term);
+		ret = transition_9(ctx, &term, &store, &stack, peek_term);
 		econf(conf, term, store, stack);
+		conf->u.econf.probe = probe;
 		return ret;
 	}
 	if (peek_term && peek_term->type == APP &&
 	    peek_term->u.app.rhs->type == VAR &&
 	    !peek_term->u.app.rhs->u.var.name) { // (10)
 		callback(i, 'A', data);
-		ret = transition_10(&stack, &term, peek_term);
+		ret = transition_10(ctx, &stack, &term, peek_term);
 		cconf(conf, stack, term);
 		return ret;
 	}
@@ -394,7 +1303,7 @@ static int transition_computed(struct conf *conf, int i,
 	    peek_term->u.abs.term->type == VAR &&
 	    !peek_term->u.abs.term->u.var.name) { // (11)
 		callback(i, 'B', data);
-		ret = transition_11(&stack, &term, peek_term);
+		ret = transition_11(ctx, &stack, &term, peek_term);
 		cconf(conf, stack, term);
 		return ret;
 	}
@@ -406,26 +1315,123 @@ static int transition_computed(struct conf *conf, int i,
 	return 1;
 }
 
-static int transition(struct conf *conf, int i,
+static int transition(struct ctx *ctx, struct conf *conf, int i,
 		      void (*callback)(int, char, void *), void *data)
 {
 	if (conf->type == ECONF) {
-		return transition_closure(conf, i, callback, data);
+		return transition_closure(ctx, conf, i, callback, data);
 	} else if (conf->type == CCONF) {
-		return transition_computed(conf, i, callback, data);
+		return transition_computed(ctx, conf, i, callback, data);
 	}
 	fprintf(stderr, "Invalid transition state %x\n", conf->type);
 	return 1;
 }
 
-static struct conf *for_each_state(struct conf *conf, int i,
-				   void (*callback)(int, char, void *),
-				   void *data)
+// returns 0 if the machine stopped after max steps or because of the budget
+static int for_each_state(struct ctx *ctx, struct conf *conf, int *i,
+			  size_t max, void (*callback)(int, char, void *),
+			  void *data)
 {
 	int ret = 0;
-	while (!ret)
-		ret = transition(conf, i++, callback, data);
-	return conf;
+	while (!ret && max--) {
+		if (!ctx->fuel && ctx_check(ctx))
+			return 0;
+		ret = transition(ctx, conf, (*i)++, callback, data);
+		if (!ret) {
+			ctx->stats.transitions++;
+			ctx->fuel--;
+		}
+	}
+	return ret;
+}
+
+struct speculation {
+	struct ctx *root;
+	struct box *box;
+};
+
+// releases the boxes claimed by the cache frames of the stack
+static void stack_release(struct stack *stack)
+{
+	for (; stack && stack->data; stack = stack_next(stack)) {
+		struct term *frame = stack->data;
+		if (frame->type != CACHE)
+			continue;
+		struct cache *cache = frame->u.other;
+		if (cache->term->type == VAR && !cache->term->u.var.name)
+			__atomic_store_n(&cache->box->state, TODO,
+					 __ATOMIC_RELEASE);
+	}
+}
+
+// evaluates a box like (3) would, but ahead of demand and with a budget
+static void speculation_run(void *data)
+{
+	struct speculation *speculation = data;
+	struct ctx *root = speculation->root;
+	struct box *box = speculation->box;
+	GC_free(speculation);
+
+	size_t budget = __atomic_load_n(&root->speculate, __ATOMIC_RELAXED);
+	if (!budget || !box_claim(box))
+		return;
+
+	struct ctx ctx;
+	ctx_child(&ctx, root);
+	ctx.pool = 0;
+
+	struct stack bottom = { 0 };
+	struct term *term;
+	struct store *store;
+	struct stack *stack = &bottom;
+	transition_3(&ctx, &term, &store, &stack, box);
+
+	struct conf conf;
+	econf(&conf, term, store, stack);
+	int ret = 0;
+	for (size_t i = 0; !ret; i++) {
+		// the box is in WHNF once (5) has popped its cache
+		if (conf.type == CCONF && conf.u.cconf.stack == &bottom)
+			break;
+		// the root sets the budget to 0 once it doesn't need any boxes
+		if (i == budget ||
+		    (!(i & 0xff) &&
+		     !__atomic_load_n(&root->speculate, __ATOMIC_RELAXED)))
+			break;
+		if (!ctx.fuel && ctx_check(&ctx))
+			break;
+		ret = transition(&ctx, &conf, i, ignore, 0);
+		if (!ret) {
+			ctx.stats.transitions++;
+			ctx.fuel--;
+		}
+	}
+
+	if (__atomic_load_n(&box->state, __ATOMIC_ACQUIRE) == DONE)
+		ctx.stats.speculated++;
+	stack_release(conf.type == ECONF ? conf.u.econf.stack :
+						conf.u.cconf.stack);
+	ctx_merge(&ctx);
+}
+
+// only pending applications are worth it, and only if there are idle workers
+// such that speculation never delays demanded work
+static void speculate(struct ctx *ctx, struct box *box)
+{
+	struct ctx *root = ctx->parent;
+	if (!__atomic_load_n(&root->speculate, __ATOMIC_RELAXED))
+		return;
+	struct closure *closure = box->term->u.other;
+	if (closure->term->type != APP ||
+	    pool_pending(ctx->pool) >= (size_t)pool_workers(ctx->pool))
+		return;
+
+	// uncollectable as the pool's deques are invisible to the collector
+	struct speculation *speculation =
+		GC_malloc_uncollectable(sizeof(*speculation));
+	speculation->root = root;
+	speculation->box = box;
+	pool_submit(ctx->pool, speculation_run, speculation);
 }
 
 static int hash_var_equal(void *lhs, void *rhs)
@@ -439,21 +1445,616 @@ static uint32_t hash_var(void *key)
 	return murmur3_32((uint8_t *)key, sizeof(int), 0);
 }
 
-struct term *reduce(struct term *term, void (*callback)(int, char, void *),
-		    void *data)
+static int hash_term_equal(void *lhs, void *rhs)
+{
+	return lhs == rhs;
+}
+
+static uint32_t hash_term(void *key)
+{
+	return murmur3_32((uint8_t *)&key, sizeof(key), 0);
+}
+
+static struct term *normalize(struct ctx *ctx, struct term *term,
+			      struct store *store,
+			      void (*callback)(int, char, void *), void *data)
 {
 	struct stack stack = { 0 };
-	struct store *store = store_new(hash_var, hash_var_equal);
 	struct conf conf = {
 		.type = ECONF,
 		.u.econf.term = term,
 		.u.econf.store = store,
 		.u.econf.stack = &stack,
 	};
-	for_each_state(&conf, 0, callback, data);
+	int i = 0;
+	for_each_state(ctx, &conf, &i, SIZE_MAX, callback, data);
+	if (ctx_exceeded(ctx))
+		return 0;
 	assert(conf.type == CCONF);
 
-	struct term *ret = duplicate_term(conf.u.cconf.term);
+	return conf.u.cconf.term;
+}
+
+// replaces the futures by their normal forms, again copying shared ones
+static struct term *join(struct term *term)
+{
+	switch (term->type) {
+	case ABS:
+		term->u.abs.term = join(term->u.abs.term);
+		return term;
+	case APP:
+		term->u.app.lhs = join(term->u.app.lhs);
+		term->u.app.rhs = join(term->u.app.rhs);
+		return term;
+	case FUTURE:;
+		struct future *future = term->u.other;
+		struct term *result = future->claimed ?
+					      duplicate_term(future->result) :
+					      future->result;
+		future->claimed = 1;
+		return join(result);
+	default:
+		return term;
+	}
+}
+
+static struct term *suspended(struct ctx *ctx, struct term *term,
+			       struct store *store)
+{
+	struct closure *closure = ctx_alloc(ctx, sizeof(*closure));
+	closure->term = term;
+	closure->store = store;
+	struct term *suspended = alloc_term(ctx, CLOSURE);
+	suspended->u.other = closure;
+	ctx->stats.output++;
+	return suspended;
+}
+
+// head normal forms are read back from the stack of the stopped machine,
+// the arguments and in whnf mode the body of the abstraction stay suspended
+static struct term *head_normal_form(struct ctx *ctx, struct conf *conf)
+{
+	struct stack *stack = conf->u.cconf.stack;
+	struct term *term = conf->u.cconf.term;
+	stack_release(stack);
+
+	if (term->type == CACHE) { // like (7)
+		struct cache *cache = term->u.other;
+		struct closure *closure = cache->term->u.other;
+		__atomic_store_n(&cache->box->state, TODO, __ATOMIC_RELEASE);
+
+		int x = ctx_name(ctx);
+		struct box *var_box = ctx_alloc(ctx, sizeof(*var_box));
+		var_box->state = DONE;
+		var_box->term = alloc_term(ctx, VAR);
+		var_box->term->u.var.name = x;
+
+		term = alloc_term(ctx, ABS);
+		term->u.abs.name = x;
+		term->u.abs.term = suspended(
+			ctx, closure->term->u.abs.term,
+			store_set(closure->store,
+				  (void *)&closure->term->u.abs.name, var_box,
+				  0));
+		ctx->stats.output++;
+	}
+
+	for (; stack && stack->data; stack = stack_next(stack)) {
+		struct term *frame = stack->data;
+		if (frame->type == APP) {
+			struct term *app = alloc_term(ctx, APP);
+			if (frame->u.app.rhs->type == CLOSURE) { // see (9)
+				struct closure *closure =
+					frame->u.app.rhs->u.other;
+				app->u.app.lhs = term;
+				app->u.app.rhs = suspended(ctx, closure->term,
+							   closure->store);
+			} else { // see (10)
+				app->u.app.lhs = frame->u.app.lhs;
+				app->u.app.rhs = term;
+			}
+			term = app;
+		} else if (frame->type == ABS) { // see (11)
+			struct term *abs = alloc_term(ctx, ABS);
+			abs->u.abs.name = frame->u.abs.name;
+			abs->u.abs.term = term;
+			term = abs;
+		} else { // boxes of cache frames stay unevaluated
+			continue;
+		}
+		ctx->stats.output++;
+	}
+	return term;
+}
+
+// an in-flight reduction, in parallel mode only the root machine runs in
+// steps while the tasks it forked run in the background
+struct reduction {
+	struct ctx *ctx;
+	struct ctx child; // of the root machine in parallel mode
+	struct stack stack;
+	struct conf conf;
+	int i;
+	int done;
+	void (*callback)(int, char, void *);
+	void *data;
+};
+
+// the configuration is set by the caller
+static void reduction_init(struct reduction *reduction, struct ctx *ctx,
+			   void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	reduction->ctx = ctx;
+	// the callback only observes the transitions of the root machine
+	if (ctx->pool) {
+		ctx_child(&reduction->child, ctx);
+		reduction->child.form = ctx->form;
+	}
+	reduction->stack.data = 0;
+	reduction->stack.next = 0;
+	reduction->i = 0;
+	reduction->done = 0;
+	reduction->callback = callback;
+	reduction->data = data;
+}
+
+// suspended subterms of head normal forms continue in their environment
+static void reduction_term(struct reduction *reduction, struct term *term)
+{
+	if (term->type == CLOSURE) {
+		struct closure *closure = term->u.other;
+		econf(&reduction->conf, closure->term, closure->store,
+		      &reduction->stack);
+	} else {
+		if (reduction->ctx->optimize & TRIM)
+			annotate_term(reduction->ctx, term);
+		if (reduction->ctx->optimize & LINEAR)
+			analyze(term, 0, 0);
+		econf(&reduction->conf, term,
+		      store_new(hash_var, hash_var_equal), &reduction->stack);
+	}
+}
 
+// the handle isn't visible to the garbage collector if the caller keeps it
+// in malloc'd memory, so it's allocated uncollectable until reduce_finish
+static struct reduction *reduction_new(void)
+{
+	struct reduction *reduction =
+		GC_malloc_uncollectable(sizeof(*reduction));
+	if (!reduction) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	return reduction;
+}
+
+struct reduction *reduce_start(struct ctx *ctx, struct term *term,
+			       void (*callback)(int, char, void *),
+			       void *data)
+{
+	struct reduction *reduction = reduction_new();
+	reduction_init(reduction, ctx, callback, data);
+	reduction_term(reduction, term);
+	return reduction;
+}
+
+// runs at most steps transitions, returns 1 once the reduction is done or
+// the budget is exceeded
+int reduce_run(struct reduction *reduction, size_t steps)
+{
+	struct ctx *ctx = reduction->ctx->pool ? &reduction->child :
+						 reduction->ctx;
+	if (!reduction->done)
+		reduction->done =
+			for_each_state(ctx, &reduction->conf, &reduction->i,
+				       steps, reduction->callback,
+				       reduction->data);
+	return reduction->done || ctx_exceeded(ctx);
+}
+
+static struct term *reduction_finish(struct reduction *reduction)
+{
+	struct ctx *ctx = reduction->ctx;
+	if (!reduction->done) {
+		budget_state within = WITHIN_BUDGET;
+		__atomic_compare_exchange_n(&ctx->exceeded, &within, CANCELLED,
+					    0, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED);
+	}
+	struct conf *conf = &reduction->conf;
+	struct term *ret = 0;
+	if (!ctx->pool && !ctx_exceeded(ctx))
+		ret = ctx->form == NORMAL_FORM ? conf->u.cconf.term :
+						 head_normal_form(ctx, conf);
+
+	if (ctx->pool) {
+		ctx_merge(&reduction->child);
+
+		// cancels the remaining speculations
+		size_t speculate = ctx->speculate;
+		__atomic_store_n(&ctx->speculate, 0, __ATOMIC_RELAXED);
+		pool_wait(ctx->pool);
+		ctx->speculate = speculate;
+
+		if (!ctx_exceeded(ctx))
+			ret = ctx->form == NORMAL_FORM ?
+				      join(conf->u.cconf.term) :
+				      head_normal_form(ctx, conf);
+	}
+
+	// the table is keyed by address, the terms of the next reduction may
+	// reuse those of this one once they are collected
+	if (!ctx->parent)
+		__atomic_store_n(&ctx->free_vars, 0, __ATOMIC_RELEASE);
 	return ret;
 }
+
+// returns 0 if the reduction was cancelled before it was done or if the
+// budget is exceeded, ctx->exceeded tells which limit
+struct term *reduce_finish(struct reduction *reduction)
+{
+	struct term *ret = reduction_finish(reduction);
+	GC_free(reduction);
+	return ret;
+}
+
+struct term *reduce(struct ctx *ctx, struct term *term,
+		    void (*callback)(int, char, void *), void *data)
+{
+	switch (ctx->engine) {
+	case FIREBALL:
+		return fireball(ctx, term, callback, data);
+	case CRUMBLING:
+		return crumble(ctx, term, callback, data);
+	case INTERACTION:
+		return net(ctx, term, callback, data);
+	case BYTECODE:
+		return vm(ctx, term, callback, data);
+	case SUPERCOMBINATOR:
+		return lift(ctx, term, callback, data);
+	case RKNL:
+	default:
+		break;
+	}
+
+	struct reduction reduction;
+	reduction_init(&reduction, ctx, callback, data);
+	reduction_term(&reduction, term);
+	reduce_run(&reduction, SIZE_MAX);
+	return reduction_finish(&reduction);
+}
+
+// checkpoints contain the complete configuration of the machine, the
+// objects are written depth-first the first time they are referenced -- the
+// graphs of long reductions are too deep for recursion, so both directions
+// use an explicit stack of pending objects, pushed in the same order
+
+typedef enum {
+	SAVED_TERM,
+	SAVED_KEY, // abstraction whose name is the key of a binding
+	SAVED_BOX,
+	SAVED_STORE,
+	SAVED_CLOSURE,
+	SAVED_CACHE,
+} saved_type;
+
+// the object itself when saving, the field it's loaded into when loading
+struct saved {
+	saved_type type;
+	void *object;
+};
+
+struct pending {
+	struct ctx *ctx; // when loading
+	struct checkpoint *checkpoint;
+	struct saved *saved;
+	size_t count, size;
+};
+
+static void pending_push(struct pending *pending, saved_type type, void *object)
+{
+	if (pending->count == pending->size) {
+		pending->size = pending->size ? pending->size * 2 : 64;
+		pending->saved = xrealloc(pending->saved,
+					  pending->size * sizeof(*pending->saved));
+	}
+	pending->saved[pending->count++] = (struct saved){ type, object };
+}
+
+// keys are the names of abstractions
+static void save_binding(void *key, void *value, void *data)
+{
+	struct pending *pending = data;
+	pending_push(pending, SAVED_KEY,
+		     (char *)key - offsetof(struct term, u.abs.name));
+	pending_push(pending, SAVED_BOX, value);
+}
+
+static void save_term(struct pending *pending, struct term *term)
+{
+	struct checkpoint *checkpoint = pending->checkpoint;
+	checkpoint_write(checkpoint, term->type);
+	checkpoint_write(checkpoint, term->hash);
+	switch (term->type) {
+	case ABS:
+		checkpoint_write(checkpoint, (unsigned)term->u.abs.name);
+		pending_push(pending, SAVED_TERM, term->u.abs.term);
+		break;
+	case APP:
+		pending_push(pending, SAVED_TERM, term->u.app.rhs);
+		pending_push(pending, SAVED_TERM, term->u.app.lhs);
+		break;
+	case VAR:
+		checkpoint_write(checkpoint, (unsigned)term->u.var.name);
+		checkpoint_write(checkpoint, term->u.var.type);
+		break;
+	case CLOSURE:
+		pending_push(pending, SAVED_CLOSURE, term->u.other);
+		break;
+	case CACHE:
+		pending_push(pending, SAVED_CACHE, term->u.other);
+		break;
+	case INV:
+	case FUTURE:
+	default:
+		fprintf(stderr, "Invalid term type %d in checkpoint\n",
+			term->type);
+		checkpoint_fail(checkpoint);
+	}
+}
+
+// writes the object and everything reachable from it that isn't written yet
+static void save(struct checkpoint *checkpoint, saved_type type, void *object)
+{
+	struct pending pending = { 0 };
+	pending.checkpoint = checkpoint;
+	pending_push(&pending, type, object);
+	while (pending.count && !checkpoint_failed(checkpoint)) {
+		struct saved saved = pending.saved[--pending.count];
+		if (!checkpoint_write_ref(checkpoint, saved.object))
+			continue;
+		switch (saved.type) {
+		case SAVED_TERM:
+		case SAVED_KEY:
+			save_term(&pending, saved.object);
+			break;
+		case SAVED_BOX:;
+			struct box *box = saved.object;
+			checkpoint_write(checkpoint, box->state);
+			pending_push(&pending, SAVED_TERM, box->term);
+			break;
+		case SAVED_STORE:
+			store_write(saved.object, checkpoint, save_binding,
+				    &pending);
+			break;
+		case SAVED_CLOSURE:;
+			struct closure *closure = saved.object;
+			pending_push(&pending, SAVED_STORE, closure->store);
+			pending_push(&pending, SAVED_TERM, closure->term);
+			break;
+		case SAVED_CACHE:;
+			struct cache *cache = saved.object;
+			pending_push(&pending, SAVED_TERM, cache->term);
+			pending_push(&pending, SAVED_BOX, cache->box);
+			break;
+		default:
+			break;
+		}
+	}
+	free(pending.saved);
+}
+
+// the frames above the bottom of the stack, topmost first
+static void save_stack(struct checkpoint *checkpoint, struct stack *stack)
+{
+	size_t count = 0;
+	for (struct stack *frame = stack; frame->next; frame = frame->next)
+		count++;
+	checkpoint_write(checkpoint, count);
+	for (; stack->next; stack = stack->next)
+		save(checkpoint, SAVED_TERM, stack->data);
+}
+
+// only sequential reductions can be saved, forked subterms aren't part of
+// the configuration
+int reduce_checkpoint(struct reduction *reduction, FILE *file)
+{
+	struct ctx *ctx = reduction->ctx;
+	if (ctx->pool) {
+		fprintf(stderr, "Can't checkpoint parallel reductions\n");
+		return 1;
+	}
+
+	struct checkpoint *checkpoint = checkpoint_writer(file);
+	checkpoint_write(checkpoint, (unsigned)ctx->name);
+	checkpoint_write(checkpoint, ctx->stats.transitions);
+	checkpoint_write(checkpoint, ctx->stats.allocations);
+	checkpoint_write(checkpoint, ctx->stats.allocated);
+	checkpoint_write(checkpoint, ctx->stats.output);
+	checkpoint_write(checkpoint, reduction->i);
+	checkpoint_write(checkpoint, reduction->done);
+
+	struct conf *conf = &reduction->conf;
+	checkpoint_write(checkpoint, conf->type);
+	if (conf->type == ECONF) {
+		save(checkpoint, SAVED_TERM, conf->u.econf.term);
+		save(checkpoint, SAVED_STORE, conf->u.econf.store);
+		save_stack(checkpoint, conf->u.econf.stack);
+	} else {
+		save_stack(checkpoint, conf->u.cconf.stack);
+		save(checkpoint, SAVED_TERM, conf->u.cconf.term);
+	}
+	return checkpoint_close(checkpoint);
+}
+
+static void load_binding(void **key, void **value, void *data)
+{
+	struct pending *pending = data;
+	pending_push(pending, SAVED_KEY, key);
+	pending_push(pending, SAVED_BOX, value);
+}
+
+static struct term *load_term(struct pending *pending)
+{
+	struct checkpoint *checkpoint = pending->checkpoint;
+	struct term *term = alloc_term(pending->ctx, INV);
+	checkpoint_define(checkpoint, term);
+	term->type = checkpoint_read(checkpoint);
+	term->hash = checkpoint_read(checkpoint);
+	switch (term->type) {
+	case ABS:
+		term->u.abs.name = (unsigned)checkpoint_read(checkpoint);
+		pending_push(pending, SAVED_TERM, &term->u.abs.term);
+		break;
+	case APP:
+		pending_push(pending, SAVED_TERM, &term->u.app.rhs);
+		pending_push(pending, SAVED_TERM, &term->u.app.lhs);
+		break;
+	case VAR:
+		term->u.var.name = (unsigned)checkpoint_read(checkpoint);
+		term->u.var.type = checkpoint_read(checkpoint);
+		break;
+	case CLOSURE:
+		pending_push(pending, SAVED_CLOSURE, &term->u.other);
+		break;
+	case CACHE:
+		pending_push(pending, SAVED_CACHE, &term->u.other);
+		break;
+	case INV:
+	case FUTURE:
+	default:
+		checkpoint_fail(checkpoint);
+		term->type = INV;
+	}
+	return term;
+}
+
+// the key of a binding is the name of an abstraction
+static void *load_key(struct pending *pending, struct term *abs)
+{
+	if (!abs || abs->type != ABS) {
+		checkpoint_fail(pending->checkpoint);
+		abs = alloc_term(pending->ctx, ABS);
+	}
+	return &abs->u.abs.name;
+}
+
+// reads an object written by save, returns 0 if it's invalid
+static void *load(struct ctx *ctx, struct checkpoint *checkpoint,
+		  saved_type type)
+{
+	void *object = 0;
+	struct pending pending = { 0 };
+	pending.ctx = ctx;
+	pending.checkpoint = checkpoint;
+	pending_push(&pending, type, &object);
+	while (pending.count && !checkpoint_failed(checkpoint)) {
+		struct saved saved = pending.saved[--pending.count];
+		void **field = saved.object;
+		void *known;
+		if (!checkpoint_read_ref(checkpoint, &known)) {
+			*field = saved.type == SAVED_KEY ?
+					 load_key(&pending, known) :
+					 known;
+			continue;
+		}
+		switch (saved.type) {
+		case SAVED_TERM:
+			*field = load_term(&pending);
+			break;
+		case SAVED_KEY:
+			*field = load_key(&pending, load_term(&pending));
+			break;
+		case SAVED_BOX:;
+			struct box *box = ctx_alloc(ctx, sizeof(*box));
+			checkpoint_define(checkpoint, box);
+			box->state = checkpoint_read(checkpoint) == DONE ? DONE :
+									  TODO;
+			*field = box;
+			pending_push(&pending, SAVED_TERM, &box->term);
+			break;
+		case SAVED_STORE:;
+			struct store *store = store_new(hash_var, hash_var_equal);
+			checkpoint_define(checkpoint, store);
+			*field = store;
+			store_read(store, checkpoint, load_binding, &pending);
+			break;
+		case SAVED_CLOSURE:;
+			struct closure *closure =
+				ctx_alloc(ctx, sizeof(*closure));
+			checkpoint_define(checkpoint, closure);
+			*field = closure;
+			pending_push(&pending, SAVED_STORE, &closure->store);
+			pending_push(&pending, SAVED_TERM, &closure->term);
+			break;
+		case SAVED_CACHE:;
+			struct cache *cache = ctx_alloc(ctx, sizeof(*cache));
+			checkpoint_define(checkpoint, cache);
+			*field = cache;
+			pending_push(&pending, SAVED_TERM, &cache->term);
+			pending_push(&pending, SAVED_BOX, &cache->box);
+			break;
+		default:
+			break;
+		}
+	}
+	free(pending.saved);
+	return object;
+}
+
+static struct stack *load_stack(struct ctx *ctx, struct checkpoint *checkpoint,
+				struct stack *bottom)
+{
+	size_t count = checkpoint_read(checkpoint);
+	struct stack *stack = bottom;
+	struct stack **link = &stack;
+	while (count-- && !checkpoint_failed(checkpoint)) {
+		struct stack *frame = stack_push(ctx, bottom, 0);
+		frame->data = load(ctx, checkpoint, SAVED_TERM);
+		*link = frame;
+		link = &frame->next;
+	}
+	return stack;
+}
+
+// returns 0 if the checkpoint is invalid, the budget of ctx starts again
+struct reduction *reduce_restore(struct ctx *ctx, FILE *file,
+				 void (*callback)(int, char, void *),
+				 void *data)
+{
+	struct checkpoint *checkpoint = checkpoint_reader(file);
+	if (!checkpoint)
+		return 0;
+	ctx->name = (unsigned)checkpoint_read(checkpoint);
+	ctx->stats.transitions = checkpoint_read(checkpoint);
+	ctx->stats.allocations = checkpoint_read(checkpoint);
+	ctx->stats.allocated = checkpoint_read(checkpoint);
+	ctx->stats.output = checkpoint_read(checkpoint);
+
+	struct reduction *reduction = reduction_new();
+	reduction_init(reduction, ctx, callback, data);
+	reduction->i = checkpoint_read(checkpoint);
+	reduction->done = checkpoint_read(checkpoint);
+
+	struct conf *conf = &reduction->conf;
+	struct ctx *machine = ctx->pool ? &reduction->child : ctx;
+	if (checkpoint_read(checkpoint) == ECONF) {
+		struct term *term = load(machine, checkpoint, SAVED_TERM);
+		struct store *store = load(machine, checkpoint, SAVED_STORE);
+		struct stack *stack =
+			load_stack(machine, checkpoint, &reduction->stack);
+		econf(conf, term, store, stack);
+	} else {
+		struct stack *stack =
+			load_stack(machine, checkpoint, &reduction->stack);
+		cconf(conf, stack, load(machine, checkpoint, SAVED_TERM));
+	}
+
+	if (checkpoint_close(checkpoint) ||
+	    (conf->type == ECONF && !conf->u.econf.store)) {
+		GC_free(reduction);
+		return 0;
+	}
+	return reduction;
+}
@@ -0,0 +1,454 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// distributes normalizations over calm processes, see reducer.c for the tasks
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#include <remote.h>
+#include <reducer.h>
+#include <pool.h>
+
+struct connection {
+	pthread_mutex_t lock; // held while a task is in flight
+	int fd; // -1 once the connection broke
+	FILE *in;
+};
+
+struct remote {
+	struct connection *connections;
+	int count;
+};
+
+struct bits {
+	char *data;
+	size_t length, size;
+};
+
+// names of the enclosing abstractions, innermost last
+struct scope {
+	int *names;
+	size_t depth, size;
+};
+
+static void bits_put(struct bits *bits, char bit)
+{
+	if (bits->length + 2 > bits->size) {
+		bits->size = bits->size ? bits->size * 2 : 64;
+		bits->data = xrealloc(bits->data, bits->size);
+	}
+	bits->data[bits->length++] = bit;
+}
+
+static void scope_push(struct scope *scope, int name)
+{
+	if (scope->depth == scope->size) {
+		scope->size = scope->size ? scope->size * 2 : 64;
+		scope->names =
+			xrealloc(scope->names, scope->size * sizeof(int));
+	}
+	scope->names[scope->depth++] = name;
+}
+
+static int blc_helper(struct term *term, struct bits *bits,
+		      struct scope *scope)
+{
+	switch (term->type) {
+	case ABS:
+		bits_put(bits, '0');
+		bits_put(bits, '0');
+		scope_push(scope, term->u.abs.name);
+		int ret = blc_helper(term->u.abs.term, bits, scope);
+		scope->depth--;
+		return ret;
+	case APP:
+		bits_put(bits, '0');
+		bits_put(bits, '1');
+		return blc_helper(term->u.app.lhs, bits, scope) &&
+		       blc_helper(term->u.app.rhs, bits, scope);
+	case VAR:;
+		size_t index = 0;
+		while (index < scope->depth &&
+		       scope->names[scope->depth - index - 1] !=
+			       term->u.var.name)
+			index++;
+		if (index == scope->depth)
+			return 0;
+		for (size_t i = 0; i <= index; i++)
+			bits_put(bits, '1');
+		bits_put(bits, '0');
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// the line of a closed term with barendregt variables, 0 if it's not closed
+char *remote_blc(struct term *term)
+{
+	struct bits bits = { 0 };
+	struct scope scope = { 0 };
+	int ret = blc_helper(term, &bits, &scope);
+	free(scope.names);
+	if (!ret) {
+		free(bits.data);
+		return 0;
+	}
+	bits_put(&bits, '\n');
+	bits.data[bits.length] = 0;
+	return bits.data;
+}
+
+static struct term *term_helper(struct ctx *ctx, const char **blc,
+				struct scope *scope)
+{
+	const char *bits = *blc;
+	struct term *term = 0;
+	if (bits[0] == '0' && bits[1] == '0') {
+		*blc += 2;
+		term = ctx_alloc(ctx, sizeof(*term));
+		term->type = ABS;
+		term->u.abs.name = ctx_name(ctx);
+		scope_push(scope, term->u.abs.name);
+		term->u.abs.term = term_helper(ctx, blc, scope);
+		scope->depth--;
+		return term->u.abs.term ? term : 0;
+	} else if (bits[0] == '0' && bits[1] == '1') {
+		*blc += 2;
+		term = ctx_alloc(ctx, sizeof(*term));
+		term->type = APP;
+		term->u.app.lhs = term_helper(ctx, blc, scope);
+		term->u.app.rhs =
+			term->u.app.lhs ? term_helper(ctx, blc, scope) : 0;
+		return term->u.app.rhs ? term : 0;
+	} else if (bits[0] == '1') {
+		size_t ones = 0;
+		while (**blc == '1') {
+			(*blc)++;
+			ones++;
+		}
+		if (*(*blc)++ != '0' || ones > scope->depth)
+			return 0;
+		term = ctx_alloc(ctx, sizeof(*term));
+		term->type = VAR;
+		term->u.var.name = scope->names[scope->depth - ones];
+		term->u.var.type = BARENDREGT_VARIABLE;
+		return term;
+	}
+	return 0;
+}
+
+// returns the body below the first count abstractions, 0 if blc is invalid
+struct term *remote_term(struct ctx *ctx, const char *blc, const int *names,
+			 size_t count)
+{
+	struct scope scope = { 0 };
+	struct term *term = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (blc[0] != '0' || blc[1] != '0')
+			goto end;
+		blc += 2;
+		scope_push(&scope, names[i]);
+	}
+
+	term = term_helper(ctx, &blc, &scope);
+	if (term && *blc && *blc != '\n' && *blc != '\r')
+		term = 0;
+
+end:
+	free(scope.names);
+	return term;
+}
+
+static void socket_error(const char *address, int passive)
+{
+	fprintf(stderr, "Can't %s %s: %s\n",
+		passive ? "listen on" : "connect to", address,
+		strerror(errno));
+}
+
+static int unix_socket(const char *address, int passive)
+{
+	struct sockaddr_un un = { 0 };
+	if (strlen(address) >= sizeof(un.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", address);
+		return -1;
+	}
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, address);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		socket_error(address, passive);
+		return -1;
+	}
+
+	if (passive)
+		unlink(address); // left over by a previous worker
+	int ret = passive ? bind(fd, (struct sockaddr *)&un, sizeof(un)) :
+			    connect(fd, (struct sockaddr *)&un, sizeof(un));
+	if (ret < 0) {
+		socket_error(address, passive);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int tcp_socket(const char *address, int passive)
+{
+	char *host = xrealloc(0, strlen(address) + 1);
+	strcpy(host, address);
+	char *port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "Invalid address %s\n", address);
+		free(host);
+		return -1;
+	}
+	*port++ = 0;
+
+	struct addrinfo hints = { 0 }, *infos;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	int err = getaddrinfo(*host ? host : 0, port, &hints, &infos);
+	free(host);
+	if (err) {
+		fprintf(stderr, "Can't resolve %s: %s\n", address,
+			gai_strerror(err));
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *info = infos; info && fd < 0;
+	     info = info->ai_next) {
+		fd = socket(info->ai_family, info->ai_socktype,
+			    info->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		if (passive)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+				   sizeof(one));
+		int ret = passive ? bind(fd, info->ai_addr, info->ai_addrlen) :
+				    connect(fd, info->ai_addr,
+					    info->ai_addrlen);
+		if (ret < 0) {
+			int error = errno;
+			close(fd);
+			errno = error;
+			fd = -1;
+		}
+	}
+	freeaddrinfo(infos);
+	if (fd < 0)
+		socket_error(address, passive);
+	return fd;
+}
+
+static int address_socket(const char *address, int passive)
+{
+	if (strchr(address, '/'))
+		return unix_socket(address, passive);
+	return tcp_socket(address, passive);
+}
+
+static int write_line(int fd, const char *line)
+{
+	size_t length = strlen(line);
+	while (length) {
+		ssize_t written = write(fd, line, length);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		line += written;
+		length -= written;
+	}
+	return 0;
+}
+
+struct remote *remote_connect(const char *addresses)
+{
+	// broken connections are noticed by failing writes instead
+	signal(SIGPIPE, SIG_IGN);
+
+	struct remote *remote = xrealloc(0, sizeof(*remote));
+	remote->count = 0;
+	remote->connections = 0;
+
+	const char *address = addresses;
+	while (*address) {
+		size_t length = strcspn(address, ",");
+		char *copy = xrealloc(0, length + 1);
+		memcpy(copy, address, length);
+		copy[length] = 0;
+		int fd = address_socket(copy, 0);
+		free(copy);
+		if (fd < 0) {
+			remote_disconnect(remote);
+			return 0;
+		}
+
+		remote->connections = xrealloc(
+			remote->connections,
+			(remote->count + 1) * sizeof(*remote->connections));
+		struct connection *connection =
+			&remote->connections[remote->count++];
+		pthread_mutex_init(&connection->lock, 0);
+		connection->fd = fd;
+		connection->in = fdopen(fd, "r");
+
+		address += length;
+		if (*address == ',')
+			address++;
+	}
+	return remote;
+}
+
+// returns an idle connection, which is locked until the call, or -1
+int remote_acquire(struct remote *remote)
+{
+	for (int i = 0; i < remote->count; i++) {
+		struct connection *connection = &remote->connections[i];
+		if (pthread_mutex_trylock(&connection->lock))
+			continue;
+		if (connection->fd >= 0)
+			return i;
+		pthread_mutex_unlock(&connection->lock);
+	}
+	return -1;
+}
+
+// sends a task line and returns the line of its normal form, 0 on failure
+char *remote_call(struct remote *remote, int connection, const char *task)
+{
+	struct connection *conn = &remote->connections[connection];
+	char *line = 0;
+	size_t size = 0;
+	if (write_line(conn->fd, task) < 0 ||
+	    getline(&line, &size, conn->in) <= 0) {
+		fprintf(stderr, "Lost connection to worker %d\n", connection);
+		fclose(conn->in);
+		conn->fd = -1;
+		free(line);
+		line = 0;
+	} else if (line[0] == '\n') { // the worker couldn't parse the task
+		free(line);
+		line = 0;
+	}
+	pthread_mutex_unlock(&conn->lock);
+	return line;
+}
+
+void remote_release(struct remote *remote, int connection)
+{
+	pthread_mutex_unlock(&remote->connections[connection].lock);
+}
+
+int remote_connections(struct remote *remote)
+{
+	return remote->count;
+}
+
+void remote_disconnect(struct remote *remote)
+{
+	for (int i = 0; i < remote->count; i++) {
+		struct connection *connection = &remote->connections[i];
+		if (connection->fd >= 0)
+			fclose(connection->in);
+		pthread_mutex_destroy(&connection->lock);
+	}
+	free(remote->connections);
+	free(remote);
+}
+
+int remote_listen(const char *address)
+{
+	int fd = address_socket(address, 1);
+	if (fd >= 0 && listen(fd, SOMAXCONN) < 0) {
+		socket_error(address, 1);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void ignore(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
+static int serve(int fd, int parallel)
+{
+	FILE *in = fdopen(fd, "r");
+	struct pool *pool = parallel ? pool_new(parallel) : 0;
+	char *line = 0;
+	size_t size = 0;
+	while (getline(&line, &size, in) > 0) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		ctx.pool = pool;
+
+		char *blc = 0;
+		struct term *term = remote_term(&ctx, line, 0, 0);
+		if (term) {
+			// without a result (budget exceeded or cancelled) the
+			// caller gets the empty line and reduces it itself
+			struct term *res = reduce(&ctx, term, ignore, 0);
+			if (res) {
+				blc = remote_blc(res);
+				free_term(res);
+			}
+			free_term(term);
+		}
+
+		int ret = write_line(fd, blc ? blc : "\n");
+		free(blc);
+		if (ret < 0)
+			break;
+	}
+
+	free(line);
+	fclose(in);
+	if (pool)
+		pool_destroy(pool);
+	return 0;
+}
+
+// every connection is served by its own process
+int remote_serve(int fd, int parallel)
+{
+	signal(SIGCHLD, SIG_IGN); // no zombies
+	while (1) {
+		int connection = accept(fd, 0, 0);
+		if (connection < 0 && errno == EINTR)
+			continue;
+		if (connection < 0) {
+			fprintf(stderr, "Can't accept connection: %s\n",
+				strerror(errno));
+			return 1;
+		}
+
+		pid_t pid = fork();
+		if (!pid) {
+			close(fd);
+			_exit(serve(connection, parallel));
+		}
+		if (pid < 0)
+			fprintf(stderr, "Can't fork worker: %s\n",
+				strerror(errno));
+		close(connection);
+	}
+}
@@ -30,11 +30,13 @@
  */
 
 #include <malloc.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <store.h>
+#include <checkpoint.h>
 #include <gc.h>
 
 #define store_node_debug_fmt                                                   \
@@ -239,7 +241,7 @@ static struct node *store_node_acquire(struct node *node)
 {
 	if (node == &empty_node)
 		return node;
-	node->ref_count++;
+	__atomic_add_fetch(&node->ref_count, 1, __ATOMIC_RELAXED);
 	return node;
 }
 
@@ -249,7 +251,7 @@ static void store_node_release(struct node *node)
 	if (node == &empty_node)
 		return;
 
-	if (node->ref_count-- == 1)
+	if (__atomic_fetch_sub(&node->ref_count, 1, __ATOMIC_ACQ_REL) == 1)
 		node_destroy(node);
 }
 
@@ -717,15 +719,18 @@ struct store *store_new(STORE_HASHFN_T(hash), STORE_EQUALSFN_T(equals))
 
 struct store *store_acquire(struct store *store)
 {
-	store->ref_count++;
-	DEBUG_NOTICE("ACQ %p: %d\n", (void *)store, store->ref_count);
+	uint32_t count =
+		__atomic_add_fetch(&store->ref_count, 1, __ATOMIC_RELAXED);
+	DEBUG_NOTICE("ACQ %p: %d\n", (void *)store, count);
 	return store;
 }
 
 void store_release(struct store **store)
 {
-	DEBUG_NOTICE("REL %p: %d\n", (void *)*store, (*store)->ref_count - 1);
-	if ((*store)->ref_count-- == 1)
+	uint32_t count = __atomic_fetch_sub(&(*store)->ref_count, 1,
+					    __ATOMIC_ACQ_REL);
+	DEBUG_NOTICE("REL %p: %d\n", (void *)*store, count - 1);
+	if (count == 1)
 		store_destroy(store);
 }
 
@@ -761,6 +766,164 @@ struct store *store_set(const struct store *store, STORE_KEY_T key,
 			  store->hash, store->equals);
 }
 
+// an entry of store_set_all, order holds the chunks of the hash from the
+// lowest one on, so sorting groups the entries by their chunk on every level
+struct batch_entry {
+	uint64_t order;
+	size_t index; // in the arguments, later entries win
+	uint32_t hash;
+	STORE_KEY_T key;
+	STORE_VALUE_T value;
+};
+
+static int batch_entry_compare(const void *a, const void *b)
+{
+	const struct batch_entry *x = a, *y = b;
+	if (x->order != y->order)
+		return x->order < y->order ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// copies node once with all of the sorted entries set, added counts the new
+// keys -- the result is the same as setting them one after another, carry
+// is an element of a node above that is pushed down along with the entries
+static struct node *node_set_all(struct node *node, STORE_HASHFN_T(hashfn),
+				 STORE_EQUALSFN_T(equals),
+				 const STORE_NODE_ELEMENT_T *carry,
+				 struct batch_entry *entries, size_t length,
+				 unsigned shift, unsigned *added)
+{
+	if (shift >= HASH_TOTAL_WIDTH) {
+		struct collision_node *collision =
+			carry ? collision_node_new(carry, 1) :
+				(struct collision_node *)node;
+		for (size_t i = 0; i < length; i++) {
+			int found = 0;
+			struct collision_node *next = collision_node_update(
+				collision, equals, entries[i].key,
+				entries[i].value, &found);
+			// intermediate nodes are only referenced here
+			if (collision != (struct collision_node *)node)
+				node_destroy((struct node *)collision);
+			collision = next;
+			*added += !found;
+		}
+		return (struct node *)collision;
+	}
+
+	// only the positions taken by the node or the entries are visited
+	uint32_t carry_bitpos =
+		carry ? 1u << store_mask(hashfn(carry->key), shift) : 0;
+	uint32_t positions = node->element_map | node->branch_map | carry_bitpos;
+	for (size_t i = 0; i < length; i++)
+		positions |= 1u << store_mask(entries[i].hash, shift);
+
+	STORE_NODE_ELEMENT_T elements[1u << HASH_PARTITION_WIDTH];
+	STORE_NODE_BRANCH_T branches[1u << HASH_PARTITION_WIDTH];
+	uint32_t element_map = 0, branch_map = 0;
+	unsigned element_arity = 0, branch_arity = 0;
+	size_t i = 0;
+	for (; positions; positions &= positions - 1) {
+		const uint32_t bitpos = positions & -positions;
+		const unsigned chunk = bitcount(bitpos - 1);
+		struct batch_entry *group = &entries[i];
+		size_t count = 0;
+		for (; i < length && store_mask(entries[i].hash, shift) == chunk;
+		     i++)
+			count++;
+
+		if (node->branch_map & bitpos) {
+			struct node *branch = STORE_NODE_BRANCH_AT(node, bitpos);
+			branches[branch_arity++] =
+				count ? node_set_all(branch, hashfn, equals,
+						     NULL, group, count,
+						     shift + HASH_PARTITION_WIDTH,
+						     added) :
+					branch;
+			branch_map |= bitpos;
+			continue;
+		}
+
+		// the node is empty where the carried element goes
+		const STORE_NODE_ELEMENT_T *current =
+			node->element_map & bitpos ?
+				&STORE_NODE_ELEMENT_AT(node, bitpos) :
+			bitpos == carry_bitpos ? carry :
+						 NULL;
+		if (!count) {
+			elements[element_arity++] = *current;
+			element_map |= bitpos;
+			continue;
+		}
+
+		// a single key stays an element, more go one level down
+		STORE_KEY_T key = current ? current->key : group[0].key;
+		size_t same = 0;
+		while (same < count && equals(group[same].key, key))
+			same++;
+		if (same == count) {
+			elements[element_arity].key = key;
+			elements[element_arity++].val = group[count - 1].value;
+			element_map |= bitpos;
+			*added += !current;
+			continue;
+		}
+
+		branches[branch_arity++] = node_set_all(
+			&empty_node, hashfn, equals, current, group, count,
+			shift + HASH_PARTITION_WIDTH, added);
+		branch_map |= bitpos;
+	}
+
+	return node_new(element_map, branch_map, elements, element_arity,
+			branches, branch_arity);
+}
+
+struct store *store_set_all(const struct store *store, STORE_KEY_T *keys,
+			    STORE_VALUE_T *values, size_t length)
+{
+	struct batch_entry buffer[1u << HASH_PARTITION_WIDTH];
+	struct batch_entry *entries = buffer;
+	if (length > sizeof(buffer) / sizeof(*buffer) &&
+	    !(entries = malloc(length * sizeof(*entries)))) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		uint32_t hash = store->hash(keys[i]);
+		uint64_t order = 0;
+		for (unsigned shift = 0; shift < HASH_TOTAL_WIDTH;
+		     shift += HASH_PARTITION_WIDTH)
+			order = order << HASH_PARTITION_WIDTH |
+				store_mask(hash, shift);
+		entries[i] = (struct batch_entry){ order, i, hash, keys[i],
+						   values[i] };
+	}
+	// batches are mostly the few arguments of one application
+	if (length > sizeof(buffer) / sizeof(*buffer)) {
+		qsort(entries, length, sizeof(*entries), batch_entry_compare);
+	} else {
+		for (size_t i = 1; i < length; i++) {
+			struct batch_entry entry = entries[i];
+			size_t j = i;
+			for (; j && entries[j - 1].order > entry.order; j--)
+				entries[j] = entries[j - 1];
+			entries[j] = entry;
+		}
+	}
+
+	unsigned added = 0;
+	struct node *root = length ? node_set_all(store->root, store->hash,
+						  store->equals, NULL, entries,
+						  length, 0, &added) :
+				     store->root;
+	if (entries != buffer)
+		free(entries);
+	return store_from(store_node_acquire(root), store->length + added,
+			  store->hash, store->equals);
+}
+
 STORE_VALUE_T store_get(const struct store *store, STORE_KEY_T key, int *found)
 {
 	uint32_t hash = store->hash(key);
@@ -793,6 +956,110 @@ int store_equals(const struct store *left, const struct store *right,
 				   value_equals, 0);
 }
 
+static void node_write(struct node *node, unsigned shift,
+		       struct checkpoint *checkpoint,
+		       STORE_WRITEFN_T(write), void *data)
+{
+	// the empty node is static and may have another address when read
+	checkpoint_write(checkpoint, node == &empty_node);
+	if (node == &empty_node || !checkpoint_write_ref(checkpoint, node))
+		return;
+
+	if (shift >= HASH_TOTAL_WIDTH) {
+		struct collision_node *collision =
+			(struct collision_node *)node;
+		checkpoint_write(checkpoint, collision->element_arity);
+		for (unsigned i = 0; i < collision->element_arity; ++i)
+			write(collision->content[i].key,
+			      collision->content[i].val, data);
+		return;
+	}
+
+	checkpoint_write(checkpoint, node->element_map);
+	checkpoint_write(checkpoint, node->branch_map);
+	for (unsigned i = 0; i < node->element_arity; ++i)
+		write(STORE_NODE_ELEMENTS(node)[i].key,
+		      STORE_NODE_ELEMENTS(node)[i].val, data);
+	for (unsigned i = 0; i < node->branch_arity; ++i)
+		node_write(STORE_NODE_BRANCHES(node)[i],
+			   shift + HASH_PARTITION_WIDTH, checkpoint, write,
+			   data);
+}
+
+static struct node *node_read(unsigned shift, struct checkpoint *checkpoint,
+			      STORE_READFN_T(read), void *data)
+{
+	if (checkpoint_read(checkpoint))
+		return &empty_node;
+	void *known;
+	if (!checkpoint_read_ref(checkpoint, &known)) {
+		if (!known)
+			checkpoint_fail(checkpoint);
+		return known ? known : &empty_node;
+	}
+
+	if (shift >= HASH_TOTAL_WIDTH) {
+		uint64_t element_arity = checkpoint_read(checkpoint);
+		if (element_arity > UINT8_MAX) {
+			checkpoint_fail(checkpoint);
+			element_arity = 0;
+		}
+		struct collision_node *collision =
+			GC_malloc(sizeof(*collision) +
+				  STORE_NODE_ELEMENTS_SIZE(element_arity));
+		collision->element_arity = element_arity;
+		collision->branch_arity = 0;
+		collision->ref_count = 0;
+		checkpoint_define(checkpoint, collision);
+		for (unsigned i = 0; i < element_arity; ++i)
+			read(&collision->content[i].key,
+			     &collision->content[i].val, data);
+		return (struct node *)collision;
+	}
+
+	uint32_t element_map = checkpoint_read(checkpoint);
+	uint32_t branch_map = checkpoint_read(checkpoint);
+	if (element_map & branch_map) {
+		checkpoint_fail(checkpoint);
+		element_map = branch_map = 0;
+	}
+	unsigned element_arity = bitcount(element_map);
+	unsigned branch_arity = bitcount(branch_map);
+	struct node *node = GC_malloc(
+		sizeof(*node) + STORE_NODE_ELEMENTS_SIZE(element_arity) +
+		STORE_NODE_BRANCHES_SIZE(branch_arity));
+	node->element_arity = element_arity;
+	node->branch_arity = branch_arity;
+	node->ref_count = 0;
+	node->element_map = element_map;
+	node->branch_map = branch_map;
+	checkpoint_define(checkpoint, node);
+	for (unsigned i = 0; i < element_arity; ++i)
+		read(&STORE_NODE_ELEMENTS(node)[i].key,
+		     &STORE_NODE_ELEMENTS(node)[i].val, data);
+	// reference counting
+	for (unsigned i = 0; i < branch_arity; ++i)
+		STORE_NODE_BRANCHES(node)[i] = store_node_acquire(
+			node_read(shift + HASH_PARTITION_WIDTH, checkpoint,
+				  read, data));
+	return node;
+}
+
+void store_write(const struct store *store, struct checkpoint *checkpoint,
+		 STORE_WRITEFN_T(write), void *data)
+{
+	checkpoint_write(checkpoint, store->length);
+	node_write(store->root, 0, checkpoint, write, data);
+}
+
+void store_read(struct store *store, struct checkpoint *checkpoint,
+		STORE_READFN_T(read), void *data)
+{
+	store->length = checkpoint_read(checkpoint);
+	// reference counting
+	store->root = store_node_acquire(node_read(0, checkpoint, read, data));
+}
+
 void store_iter_init(struct store_iter *iterator, const struct store *store)
 {
 	iterator->stack_level = 0;
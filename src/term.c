@@ -5,27 +5,25 @@
 #include <stdio.h>
 
 #include <term.h>
+#include <ctx.h>
+#include <murmur3.h>
 #include <gc.h>
 
-static int name_generator(void)
-{
-	static int current = 0x4242; // TODO: idk?
-	return current++;
-}
-
 #define MAX_CONVERSION_VARS 256
-static void to_barendregt_helper(struct term *term, int *vars, int size)
+static void to_barendregt_helper(struct term *term, int *vars, int size,
+				 int *name)
 {
 	assert(size < MAX_CONVERSION_VARS);
+	term->hash = 0;
 	switch (term->type) {
 	case ABS:
-		vars[size] = name_generator();
+		vars[size] = (*name)++;
 		term->u.abs.name = vars[size];
-		to_barendregt_helper(term->u.abs.term, vars, size + 1);
+		to_barendregt_helper(term->u.abs.term, vars, size + 1, name);
 		break;
 	case APP:
-		to_barendregt_helper(term->u.app.lhs, vars, size);
-		to_barendregt_helper(term->u.app.rhs, vars, size);
+		to_barendregt_helper(term->u.app.lhs, vars, size, name);
+		to_barendregt_helper(term->u.app.rhs, vars, size, name);
 		break;
 	case VAR:
 		if (term->u.var.type == BARENDREGT_VARIABLE)
@@ -34,7 +32,7 @@ static void to_barendregt_helper(struct term *term, int *vars, int size)
 		if (ind < 0) {
 			fprintf(stderr, "Unbound variable %d\n",
 				term->u.var.name);
-			term->u.var.name = name_generator();
+			term->u.var.name = (*name)++;
 		} else {
 			term->u.var.name = vars[size - term->u.var.name - 1];
 		}
@@ -48,6 +46,7 @@ static void to_barendregt_helper(struct term *term, int *vars, int size)
 static void to_bruijn_helper(struct term *term, int *vars, int size)
 {
 	assert(size < MAX_CONVERSION_VARS);
+	term->hash = 0;
 	switch (term->type) {
 	case ABS:
 		vars[size] = term->u.abs.name;
@@ -83,7 +82,8 @@ static void to_bruijn_helper(struct term *term, int *vars, int size)
 void to_barendregt(struct term *term)
 {
 	int vars[MAX_CONVERSION_VARS] = { 0 };
-	to_barendregt_helper(term, vars, 0);
+	int name = 0x4242; // names are only unique per term, see ctx_init
+	to_barendregt_helper(term, vars, 0, &name);
 }
 
 void to_bruijn(struct term *term)
@@ -110,44 +110,189 @@ struct term *duplicate_term(struct term *term)
 		struct term *abs = new_term(ABS);
 		abs->u.abs.name = term->u.abs.name;
 		abs->u.abs.term = duplicate_term(term->u.abs.term);
+		abs->hash = term->hash;
 		return abs;
 	case APP:;
 		struct term *app = new_term(APP);
 		app->u.app.lhs = duplicate_term(term->u.app.lhs);
 		app->u.app.rhs = duplicate_term(term->u.app.rhs);
+		app->hash = term->hash;
 		return app;
 	case VAR:;
 		struct term *var = new_term(VAR);
 		var->u.var.name = term->u.var.name;
 		var->u.var.type = term->u.var.type;
+		var->hash = term->hash;
 		return var;
+	case FUTURE:; // shares the pending result
+		struct term *future = new_term(FUTURE);
+		future->u.other = term->u.other;
+		return future;
 	default:
 		fprintf(stderr, "Invalid type %d\n", term->type);
 	}
 	return term;
 }
 
-int alpha_equivalency(struct term *a, struct term *b)
+// nodes of a reduction, counted in the statistics of its context
+struct term *alloc_term(struct ctx *ctx, term_type type)
+{
+	struct term *term = ctx_alloc(ctx, sizeof(*term));
+	term->type = type;
+	return term;
+}
+
+// a node of a normal form, it counts towards the output
+struct term *output_term(struct ctx *ctx, term_type type)
+{
+	ctx->stats.output++;
+	return alloc_term(ctx, type);
+}
+
+// copies a normal form -- the engines memoize the read back of a shared value
+// and give every further use its own copy, so results stay trees owned by the
+// caller
+struct term *copy_term(struct ctx *ctx, struct term *term)
 {
-	if (a->type != b->type)
+	struct term *copy = output_term(ctx, term->type);
+	copy->hash = term->hash;
+	switch (term->type) {
+	case ABS:
+		copy->u.abs.name = term->u.abs.name;
+		copy->u.abs.term = copy_term(ctx, term->u.abs.term);
+		break;
+	case APP:
+		copy->u.app.lhs = copy_term(ctx, term->u.app.lhs);
+		copy->u.app.rhs = copy_term(ctx, term->u.app.rhs);
+		break;
+	case VAR:
+		copy->u.var.name = term->u.var.name;
+		copy->u.var.type = term->u.var.type;
+		break;
+	default: // futures share the pending result
+		copy->u.other = term->u.other;
+	}
+	return copy;
+}
+
+// Merkle-style hash over the bruijn form, cached in the nodes
+uint32_t term_hash(struct term *term)
+{
+	if (term->hash)
+		return term->hash;
+
+	uint32_t data[3] = { term->type, 0, 0 };
+	switch (term->type) {
+	case ABS:
+		assert(!term->u.abs.name); // TODO: Only bruijn right now
+		data[1] = term_hash(term->u.abs.term);
+		break;
+	case APP:
+		data[1] = term_hash(term->u.app.lhs);
+		data[2] = term_hash(term->u.app.rhs);
+		break;
+	case VAR:
+		assert(term->u.var.type == BRUIJN_INDEX);
+		data[1] = term->u.var.name;
+		break;
+	default:
+		fprintf(stderr, "Invalid type %d\n", term->type);
+	}
+
+	uint32_t hash = murmur3_32((uint8_t *)data, sizeof(data), 0);
+	term->hash = hash ? hash : 1; // 0 is reserved for "not computed"
+	return term->hash;
+}
+
+// pairs of nodes already proven to be equivalent, for linear DAG comparison
+struct equivalences {
+	size_t size;
+	size_t count;
+	struct term **pairs;
+};
+
+static size_t equivalences_slot(struct equivalences *eq, struct term *a,
+				struct term *b)
+{
+	size_t i = (term_hash(a) ^ ((uintptr_t)b >> 4)) & (eq->size - 1);
+	while (eq->pairs[2 * i] &&
+	       (eq->pairs[2 * i] != a || eq->pairs[2 * i + 1] != b))
+		i = (i + 1) & (eq->size - 1);
+	return i;
+}
+
+static void equivalences_add(struct equivalences *eq, struct term *a,
+			     struct term *b)
+{
+	if (2 * (eq->count + 1) > eq->size) {
+		struct equivalences old = *eq;
+		eq->size = old.size ? 2 * old.size : 64;
+		eq->count = 0;
+		eq->pairs = xcalloc(2 * eq->size, sizeof(*eq->pairs));
+		for (size_t i = 0; i < old.size; i++)
+			if (old.pairs[2 * i])
+				equivalences_add(eq, old.pairs[2 * i],
+						 old.pairs[2 * i + 1]);
+		free(old.pairs);
+	}
+	size_t i = equivalences_slot(eq, a, b);
+	if (eq->pairs[2 * i])
+		return;
+	eq->pairs[2 * i] = a;
+	eq->pairs[2 * i + 1] = b;
+	eq->count++;
+}
+
+static int equivalences_has(struct equivalences *eq, struct term *a,
+			    struct term *b)
+{
+	if (!eq->size)
+		return 0;
+	return !!eq->pairs[2 * equivalences_slot(eq, a, b)];
+}
+
+static int alpha_equivalency_helper(struct term *a, struct term *b,
+				    struct equivalences *eq)
+{
+	if (a == b)
+		return 1;
+	if (a->type != b->type || term_hash(a) != term_hash(b))
 		return 0;
+	if (a->type == VAR)
+		return a->u.var.name == b->u.var.name;
 
+	// only shared nodes can be visited twice
+	if (equivalences_has(eq, a, b))
+		return 1;
+
+	int ret = 0;
 	switch (a->type) {
 	case ABS:
-		assert(!a->u.abs.name); // TODO: Only bruijn right now
-		return a->u.abs.name == b->u.abs.name &&
-		       alpha_equivalency(a->u.abs.term, b->u.abs.term);
+		ret = alpha_equivalency_helper(a->u.abs.term, b->u.abs.term,
+					       eq);
+		break;
 	case APP:
-		return alpha_equivalency(a->u.app.lhs, b->u.app.lhs) &&
-		       alpha_equivalency(a->u.app.rhs, b->u.app.rhs);
-	case VAR:;
-		assert(a->u.var.type == BRUIJN_INDEX &&
-		       b->u.var.type == BRUIJN_INDEX);
-		return a->u.var.name == b->u.var.name;
+		ret = alpha_equivalency_helper(a->u.app.lhs, b->u.app.lhs,
+					       eq) &&
+		      alpha_equivalency_helper(a->u.app.rhs, b->u.app.rhs, eq);
+		break;
 	default:
 		fprintf(stderr, "Invalid type %d\n", a->type);
 	}
-	return 0;
+	if (ret)
+		equivalences_add(eq, a, b);
+	return ret;
+}
+
+// unequal hashes are rejected immediately, equal hashes are verified
+// structurally while remembering already equivalent pairs of subterms such
+// that shared (DAG) terms are compared in linear time
+int alpha_equivalency(struct term *a, struct term *b)
+{
+	struct equivalences eq = { 0 };
+	int ret = alpha_equivalency_helper(a, b, &eq);
+	free(eq.pairs);
+	return ret;
 }
 
 void free_term(struct term *term)
@@ -163,6 +308,7 @@ void free_term(struct term *term)
 		GC_free(term);
 		break;
 	case VAR:
+	case CLOSURE: // suspended, its environment is left to the collector
 		GC_free(term);
 		break;
 	default:
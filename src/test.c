@@ -11,16 +11,25 @@
 
 #define TESTDIR "./tests/"
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <gc.h>
 #include <parse.h>
 #include <term.h>
 #include <reducer.h>
+#include <pool.h>
+#include <remote.h>
+#include <lazy.h>
 
 struct test {
 	struct term *in;
@@ -33,12 +42,6 @@ struct test {
 	} equivalency;
 };
 
-static int name_generator(void)
-{
-	static int current = 0xbadbad;
-	return current++;
-}
-
 static void *church(int n, void(*f(void *, int)), void *x, int name)
 {
 	if (n == 0)
@@ -56,14 +59,14 @@ static void *church_numeral_builder(void *x, int name)
 	return app;
 }
 
-static struct term *church_numeral(int n)
+static struct term *church_numeral(struct ctx *ctx, int n)
 {
 	struct term *abs = new_term(ABS);
-	abs->u.abs.name = name_generator();
+	abs->u.abs.name = ctx_name(ctx);
 	abs->u.abs.term = new_term(ABS);
 
 	struct term *var = new_term(VAR);
-	var->u.var.name = name_generator();
+	var->u.var.name = ctx_name(ctx);
 	var->u.var.type = BARENDREGT_VARIABLE;
 
 	abs->u.abs.term->u.abs.name = var->u.var.name;
@@ -73,20 +76,28 @@ static struct term *church_numeral(int n)
 	return abs;
 }
 
-static struct term *identity(void)
+static struct term *variable(int name)
+{
+	struct term *var = new_term(VAR);
+	var->u.var.name = name;
+	var->u.var.type = BARENDREGT_VARIABLE;
+	return var;
+}
+
+static struct term *identity(struct ctx *ctx)
 {
 	struct term *abs = new_term(ABS);
-	abs->u.abs.name = name_generator();
+	abs->u.abs.name = ctx_name(ctx);
 	abs->u.abs.term = new_term(VAR);
 	abs->u.abs.term->u.var.name = abs->u.abs.name;
 	abs->u.abs.term->u.var.type = BARENDREGT_VARIABLE;
 	return abs;
 }
 
-static struct term *omega(void)
+static struct term *omega(struct ctx *ctx)
 {
 	struct term *abs = new_term(ABS);
-	abs->u.abs.name = name_generator();
+	abs->u.abs.name = ctx_name(ctx);
 	abs->u.abs.term = new_term(APP);
 	abs->u.abs.term->u.app.lhs = new_term(VAR);
 	abs->u.abs.term->u.app.lhs->u.var.name = abs->u.abs.name;
@@ -97,6 +108,13 @@ static struct term *omega(void)
 	return abs;
 }
 
+static void ignore_callback(int i, char ch, void *data)
+{
+	(void)i;
+	(void)ch;
+	(void)data;
+}
+
 static void counter_callback(int i, char ch, void *data)
 {
 	(void)ch;
@@ -110,16 +128,20 @@ static void test_church_transitions(void)
 	int deviations = 0;
 	double time = 0;
 
+	struct ctx ctx;
+	ctx_init(&ctx);
+
 	for (int n = 1; n <= limit; n++) {
 		struct term *app = new_term(APP);
 		app->u.app.lhs = new_term(APP);
-		app->u.app.lhs->u.app.lhs = church_numeral(n);
-		app->u.app.lhs->u.app.rhs = church_numeral(2);
-		app->u.app.rhs = identity();
+		app->u.app.lhs->u.app.lhs = church_numeral(&ctx, n);
+		app->u.app.lhs->u.app.rhs = church_numeral(&ctx, 2);
+		app->u.app.rhs = identity(&ctx);
 		int counter;
 
 		clock_t begin = clock();
-		struct term *red = reduce(app, counter_callback, &counter);
+		struct term *red =
+			reduce(&ctx, app, counter_callback, &counter);
 		clock_t end = clock();
 		time += (double)(end - begin) / CLOCKS_PER_SEC;
 
@@ -135,6 +157,58 @@ static void test_church_transitions(void)
 	       limit, time, deviations);
 }
 
+static void *church_transitions_worker(void *data)
+{
+	int *deviations = data;
+
+	struct ctx ctx;
+	ctx_init(&ctx);
+
+	for (int n = 1; n <= 14; n++) {
+		struct term *app = new_term(APP);
+		app->u.app.lhs = new_term(APP);
+		app->u.app.lhs->u.app.lhs = church_numeral(&ctx, n);
+		app->u.app.lhs->u.app.rhs = church_numeral(&ctx, 2);
+		app->u.app.rhs = identity(&ctx);
+
+		int counter;
+		size_t before = ctx.stats.transitions;
+		struct term *red =
+			reduce(&ctx, app, counter_callback, &counter);
+		free_term(red);
+		free_term(app);
+
+		size_t expected = 10 * (2 << (n - 1)) + n * 5 + 5;
+		if (ctx.stats.transitions - before != expected)
+			(*deviations)++;
+	}
+	return 0;
+}
+
+static void test_concurrent_church_transitions(void)
+{
+	const int threads = 8;
+
+	pthread_t pool[threads];
+	int deviations[threads];
+
+	clock_t begin = clock();
+	for (int i = 0; i < threads; i++) {
+		deviations[i] = 0;
+		pthread_create(&pool[i], 0, church_transitions_worker,
+			       &deviations[i]);
+	}
+	int sum = 0;
+	for (int i = 0; i < threads; i++) {
+		pthread_join(pool[i], 0);
+		sum += deviations[i];
+	}
+	clock_t end = clock();
+
+	printf("Test concurrent church ((n 2) I) on %d threads: %.5fs, %d transition deviations\n",
+	       threads, (double)(end - begin) / CLOCKS_PER_SEC, sum);
+}
+
 static void test_explode(void)
 {
 	const int limit = 23;
@@ -142,13 +216,17 @@ static void test_explode(void)
 	int deviations = 0;
 	double time = 0;
 
+	struct ctx ctx;
+	ctx_init(&ctx);
+
 	for (int n = 1; n <= limit; n++) {
 		struct term *abs = new_term(ABS);
-		abs->u.abs.name = name_generator();
+		abs->u.abs.name = ctx_name(&ctx);
 		abs->u.abs.term = new_term(APP);
 		abs->u.abs.term->u.app.lhs = new_term(APP);
-		abs->u.abs.term->u.app.lhs->u.app.lhs = church_numeral(n);
-		abs->u.abs.term->u.app.lhs->u.app.rhs = omega();
+		abs->u.abs.term->u.app.lhs->u.app.lhs =
+			church_numeral(&ctx, n);
+		abs->u.abs.term->u.app.lhs->u.app.rhs = omega(&ctx);
 		abs->u.abs.term->u.app.rhs = new_term(VAR);
 		abs->u.abs.term->u.app.rhs->u.var.name = abs->u.abs.name;
 		abs->u.abs.term->u.app.rhs->u.var.type = BARENDREGT_VARIABLE;
@@ -156,7 +234,8 @@ static void test_explode(void)
 		int counter;
 
 		clock_t begin = clock();
-		struct term *red = reduce(abs, counter_callback, &counter);
+		struct term *red =
+			reduce(&ctx, abs, counter_callback, &counter);
 		clock_t end = clock();
 		time += (double)(end - begin) / CLOCKS_PER_SEC;
 
@@ -172,6 +251,101 @@ static void test_explode(void)
 	       limit, time, deviations);
 }
 
+static int test_budget_exceeded(struct ctx *ctx, struct term *term,
+				budget_state expected)
+{
+	struct term *red = reduce(ctx, term, ignore_callback, 0);
+	if (red)
+		free_term(red);
+	return !red && ctx->exceeded == expected ? 0 : 1;
+}
+
+static void test_budget(void)
+{
+	int deviations = 0;
+
+	struct ctx ctx;
+	ctx_init(&ctx);
+
+	struct term *app = new_term(APP);
+	app->u.app.lhs = omega(&ctx);
+	app->u.app.rhs = omega(&ctx);
+
+	clock_t begin = clock();
+	ctx.budget.transitions = 100000;
+	deviations += test_budget_exceeded(&ctx, app, TRANSITIONS_EXCEEDED);
+	deviations += ctx.stats.transitions != 100000;
+	ctx.budget.transitions = 0;
+
+	ctx.budget.allocated = 1 << 20;
+	deviations += test_budget_exceeded(&ctx, app, ALLOCATED_EXCEEDED);
+	ctx.budget.allocated = 0;
+
+	ctx.budget.time = 0.01;
+	deviations += test_budget_exceeded(&ctx, app, TIME_EXCEEDED);
+	ctx.budget.time = 0;
+	free_term(app);
+
+	// λx.((n ω) x) has 2^n applications in its normal form
+	struct term *abs = new_term(ABS);
+	abs->u.abs.name = ctx_name(&ctx);
+	abs->u.abs.term = new_term(APP);
+	abs->u.abs.term->u.app.lhs = new_term(APP);
+	abs->u.abs.term->u.app.lhs->u.app.lhs = church_numeral(&ctx, 24);
+	abs->u.abs.term->u.app.lhs->u.app.rhs = omega(&ctx);
+	abs->u.abs.term->u.app.rhs = new_term(VAR);
+	abs->u.abs.term->u.app.rhs->u.var.name = abs->u.abs.name;
+	abs->u.abs.term->u.app.rhs->u.var.type = BARENDREGT_VARIABLE;
+	ctx.budget.output = 1 << 12;
+	deviations += test_budget_exceeded(&ctx, abs, OUTPUT_EXCEEDED);
+	deviations += ctx.stats.output > 1 << 14;
+	free_term(abs);
+
+	// terms within the budget are still reduced
+	ctx.budget.transitions = 1000;
+	deviations +=
+		!test_budget_exceeded(&ctx, identity(&ctx), WITHIN_BUDGET);
+	clock_t end = clock();
+
+	printf("Test budget: %.5fs, %d deviations\n",
+	       (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
+static struct term *exploded_bruijn(int n, int index)
+{
+	struct term *term = new_term(VAR);
+	term->u.var.name = index;
+	term->u.var.type = BRUIJN_INDEX;
+	for (int i = 0; i < n; i++) {
+		struct term *app = new_term(APP);
+		app->u.app.lhs = term;
+		app->u.app.rhs = term;
+		term = app;
+	}
+	struct term *abs = new_term(ABS);
+	abs->u.abs.term = term;
+	return abs;
+}
+
+static void test_sharing_equality(void)
+{
+	const int limit = 64;
+
+	// shared terms that would have 2^limit nodes as trees
+	clock_t begin = clock();
+	int deviations = 0;
+	deviations += !alpha_equivalency(exploded_bruijn(limit, 0),
+					 exploded_bruijn(limit, 0));
+	deviations += alpha_equivalency(exploded_bruijn(limit, 0),
+					exploded_bruijn(limit, 1));
+	deviations += alpha_equivalency(exploded_bruijn(limit, 0),
+					exploded_bruijn(limit - 1, 0));
+	clock_t end = clock();
+
+	printf("Test sharing equality (x x)^n with n=%d: %.5fs, %d deviations\n",
+	       limit, (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
 static char *read_file(const char *path)
 {
 	FILE *f = fopen(path, "rb");
@@ -198,6 +372,88 @@ static char *read_file(const char *path)
 	return string;
 }
 
+// reduces the test files again using another configuration of the reducer
+static void test_corpus(struct test *tests, const char *name, struct ctx *base)
+{
+	int deviations = 0;
+	double time = 0;
+
+	for (int i = 0; i < NTESTS; i++) {
+		struct ctx ctx = *base;
+		int counter;
+
+		clock_t begin = clock();
+		struct term *res =
+			reduce(&ctx, tests[i].in, counter_callback, &counter);
+		clock_t end = clock();
+		time += (double)(end - begin) / CLOCKS_PER_SEC;
+
+		to_bruijn(res);
+		if (!alpha_equivalency(res, tests[i].red))
+			deviations++;
+		free_term(res);
+		base->stats.shipped = ctx.stats.shipped; // summed over runs
+	}
+
+	printf("Test corpus (%s): %.5fs, %d alpha deviations\n", name, time,
+	       deviations);
+}
+
+// the corpus again, with subterms normalized by two local worker processes
+static void test_remote(struct test *tests)
+{
+	int deviations = 0;
+	size_t shipped = 0;
+	char paths[2][64];
+	char addresses[sizeof(paths)];
+	pid_t pids[2];
+	int workers = 0;
+	for (; workers < 2; workers++) {
+		sprintf(paths[workers], "/tmp/calm-test-%d-%d", (int)getpid(),
+			workers);
+		int fd = remote_listen(paths[workers]);
+		if (fd < 0)
+			break;
+		fflush(stdout);
+		pids[workers] = fork();
+		if (!pids[workers])
+			_exit(remote_serve(fd, 0));
+		close(fd);
+	}
+
+	struct ctx ctx;
+	ctx_init(&ctx);
+	ctx.pool = pool_new(4);
+	ctx.remote = 0;
+	if (workers == 2) {
+		sprintf(addresses, "%s,%s", paths[0], paths[1]);
+		ctx.remote = remote_connect(addresses);
+	}
+	if (ctx.remote) {
+		test_corpus(tests, "remote", &ctx);
+		remote_disconnect(ctx.remote);
+		shipped = ctx.stats.shipped;
+		// a corpus reduced without shipping anything proves nothing
+		if (!shipped) {
+			fprintf(stderr, "Nothing was shipped to the workers!\n");
+			deviations++;
+		}
+	} else {
+		fprintf(stderr, "Remote workers couldn't be set up!\n");
+		deviations++;
+	}
+	pool_destroy(ctx.pool);
+
+	for (int i = 0; i < workers; i++) {
+		kill(pids[i], SIGTERM);
+		waitpid(pids[i], 0, 0);
+		unlink(paths[i]);
+	}
+
+	printf("Test remote shipping: %zu subterms shipped, %d deviations\n",
+	       shipped, deviations);
+}
+
 static void callback(int i, char ch, void *data)
 {
 	struct test *test = data;
@@ -207,6 +463,594 @@ static void callback(int i, char ch, void *data)
 	}
 }
 
+// reduces the suspended subterms of a head normal form again and again
+static struct term *force(struct ctx *ctx, struct term *term)
+{
+	switch (term->type) {
+	case ABS:
+		term->u.abs.term = force(ctx, term->u.abs.term);
+		return term;
+	case APP:
+		term->u.app.lhs = force(ctx, term->u.app.lhs);
+		term->u.app.rhs = force(ctx, term->u.app.rhs);
+		return term;
+	case CLOSURE:;
+		struct term *res = reduce(ctx, term, ignore_callback, 0);
+		free_term(term);
+		return force(ctx, res);
+	default:
+		return term;
+	}
+}
+
+// the corpus with head normal forms, normalized by forcing them
+static void test_head_forms(struct test *tests)
+{
+	int deviations = 0;
+
+	clock_t begin = clock();
+	for (reduction_form form = HEAD_NORMAL_FORM;
+	     form <= WEAK_HEAD_NORMAL_FORM; form++) {
+		for (int i = 0; i < NTESTS; i++) {
+			struct ctx ctx;
+			ctx_init(&ctx);
+			ctx.form = form;
+			struct term *res = force(
+				&ctx, reduce(&ctx, tests[i].in,
+					     ignore_callback, 0));
+			to_bruijn(res);
+			deviations += !alpha_equivalency(res, tests[i].red);
+			free_term(res);
+		}
+	}
+
+	// the arguments of the head aren't reduced
+	struct ctx ctx;
+	ctx_init(&ctx);
+	ctx.form = HEAD_NORMAL_FORM;
+	struct term *app = new_term(APP);
+	app->u.app.lhs = new_term(VAR);
+	app->u.app.lhs->u.var.name = ctx_name(&ctx);
+	app->u.app.lhs->u.var.type = BARENDREGT_VARIABLE;
+	app->u.app.rhs = new_term(APP);
+	app->u.app.rhs->u.app.lhs = omega(&ctx);
+	app->u.app.rhs->u.app.rhs = omega(&ctx);
+	struct term *res = reduce(&ctx, app, ignore_callback, 0);
+	deviations += res->type != APP || res->u.app.rhs->type != CLOSURE ||
+		      ctx.stats.transitions > 4;
+	free_term(res);
+	free_term(app);
+
+	// neither are the bodies of abstractions in whnf
+	ctx.form = WEAK_HEAD_NORMAL_FORM;
+	struct term *abs = new_term(ABS);
+	abs->u.abs.name = ctx_name(&ctx);
+	abs->u.abs.term = new_term(APP);
+	abs->u.abs.term->u.app.lhs = omega(&ctx);
+	abs->u.abs.term->u.app.rhs = omega(&ctx);
+	res = reduce(&ctx, abs, ignore_callback, 0);
+	deviations += res->type != ABS || res->u.abs.term->type != CLOSURE;
+	free_term(res);
+	free_term(abs);
+	clock_t end = clock();
+
+	printf("Test head normal forms: %.5fs, %d deviations\n",
+	       (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
+// returns 1 if the result of the engine equals red, or the normal form of
+// RKNL if there's none, -1 if it doesn't and 0 if the budget is exceeded
+static int test_engine_term(struct ctx *ctx, struct term *term,
+			    struct term *red, double *time)
+{
+	clock_t begin = clock();
+	struct term *res = reduce(ctx, term, ignore_callback, 0);
+	clock_t end = clock();
+	*time += (double)(end - begin) / CLOCKS_PER_SEC;
+	if (!res)
+		return 0;
+
+	struct term *expected = red;
+	if (!red) {
+		struct ctx rknl;
+		ctx_init(&rknl);
+		expected = reduce(&rknl, term, ignore_callback, 0);
+		to_bruijn(expected);
+	}
+	to_bruijn(res);
+	int equivalent = alpha_equivalency(res, expected);
+	free_term(res);
+	if (!red)
+		free_term(expected);
+	return equivalent ? 1 : -1;
+}
+
+// compares another engine with RKNL on the corpus and on church numerals
+// ((n 2) I), the budget keeps call-by-value from diverging on fixed points
+static void test_engine(struct test *tests, const char *name,
+			reduction_engine engine, size_t jit)
+{
+	int deviations = 0;
+	int exceeded = 0;
+	double time[3] = { 0 };
+	size_t transitions[3] = { 0 };
+	size_t compiled = 0;
+
+	for (int i = 0; i < NTESTS; i++) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		ctx.engine = engine;
+		ctx.jit = jit;
+		ctx.budget.transitions = 1 << 22;
+		int ret = test_engine_term(&ctx, tests[i].in, tests[i].red,
+					   &time[0]);
+		deviations += ret < 0;
+		exceeded += !ret;
+		transitions[0] += ctx.stats.transitions;
+		compiled += ctx.stats.compiled;
+	}
+
+	for (int n = 1; n <= 16; n++) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		struct term *app = new_term(APP);
+		app->u.app.lhs = new_term(APP);
+		app->u.app.lhs->u.app.lhs = church_numeral(&ctx, n);
+		app->u.app.lhs->u.app.rhs = church_numeral(&ctx, 2);
+		app->u.app.rhs = identity(&ctx);
+
+		ctx.engine = engine;
+		ctx.jit = jit;
+		deviations += test_engine_term(&ctx, app, 0, &time[1]) < 0;
+		transitions[1] += ctx.stats.transitions;
+		compiled += ctx.stats.compiled;
+
+		struct ctx rknl;
+		ctx_init(&rknl);
+		clock_t begin = clock();
+		free_term(reduce(&rknl, app, ignore_callback, 0));
+		clock_t end = clock();
+		time[2] += (double)(end - begin) / CLOCKS_PER_SEC;
+		transitions[2] += rknl.stats.transitions;
+		free_term(app);
+	}
+
+#if defined(__x86_64__) && defined(__linux__)
+	// the interpreter silently runs everything if no code was compiled
+	if (jit && !compiled) {
+		fprintf(stderr, "Nothing was compiled to native code!\n");
+		deviations++;
+	}
+#endif
+
+	printf("Test engine %s: corpus %.5fs, %zu transitions, %d over budget; church %.5fs, %zu transitions (RKNL %.5fs, %zu transitions); %d alpha deviations\n",
+	       name, time[0], transitions[0], exceeded, time[1],
+	       transitions[1], time[2], transitions[2], deviations);
+}
+
+// λa1...λan.(16 2) (λg.λb1...λbn.g bn ... b1) I a1 ... an, almost all of the
+// instructions are the GRAB and PUSH of the abstraction bodies
+static struct term *permutations(struct ctx *ctx, int n)
+{
+	struct term *fun = new_term(ABS);
+	fun->u.abs.name = ctx_name(ctx);
+	struct term *body = variable(fun->u.abs.name);
+	int *names = malloc(n * sizeof(*names));
+	for (int i = 0; i < n; i++)
+		names[i] = ctx_name(ctx);
+	for (int i = n - 1; i >= 0; i--) {
+		struct term *app = new_term(APP);
+		app->u.app.lhs = body;
+		app->u.app.rhs = variable(names[i]);
+		body = app;
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		struct term *abs = new_term(ABS);
+		abs->u.abs.name = names[i];
+		abs->u.abs.term = body;
+		body = abs;
+	}
+	fun->u.abs.term = body;
+
+	body = new_term(APP);
+	body->u.app.lhs = new_term(APP);
+	body->u.app.lhs->u.app.lhs = new_term(APP);
+	body->u.app.lhs->u.app.lhs->u.app.lhs = church_numeral(ctx, 16);
+	body->u.app.lhs->u.app.lhs->u.app.rhs = church_numeral(ctx, 2);
+	body->u.app.lhs->u.app.rhs = fun;
+	body->u.app.rhs = identity(ctx);
+	for (int i = 0; i < n; i++)
+		names[i] = ctx_name(ctx);
+	for (int i = 0; i < n; i++) {
+		struct term *app = new_term(APP);
+		app->u.app.lhs = body;
+		app->u.app.rhs = variable(names[i]);
+		body = app;
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		struct term *abs = new_term(ABS);
+		abs->u.abs.name = names[i];
+		abs->u.abs.term = body;
+		body = abs;
+	}
+	free(names);
+	return body;
+}
+
+// native code has to beat the interpreter on the instructions it replaces,
+// the faster of several runs of each is compared
+static void test_jit(void)
+{
+	const int runs = 5;
+
+	struct ctx ctx;
+	ctx_init(&ctx);
+	struct term *term = permutations(&ctx, 8);
+
+	int deviations = 0;
+	double best[2] = { 0 };
+	size_t compiled = 0;
+	struct term *expected = 0;
+	for (int i = 0; i < 2 * runs; i++) {
+		struct ctx vm;
+		ctx_init(&vm);
+		vm.engine = BYTECODE;
+		vm.jit = i % 2 ? 2 : 0;
+		clock_t begin = clock();
+		struct term *res = reduce(&vm, term, ignore_callback, 0);
+		clock_t end = clock();
+		double time = (double)(end - begin) / CLOCKS_PER_SEC;
+		if (i < 2 || time < best[i % 2])
+			best[i % 2] = time;
+		compiled += vm.stats.compiled;
+		if (!res) {
+			deviations++;
+			continue;
+		}
+		to_bruijn(res);
+		if (!expected) {
+			expected = res;
+			continue;
+		}
+		deviations += !alpha_equivalency(res, expected);
+		free_term(res);
+	}
+	if (expected)
+		free_term(expected);
+	free_term(term);
+
+#if defined(__x86_64__) && defined(__linux__)
+	deviations += !compiled || best[1] >= best[0];
+#endif
+
+	printf("Test jit on 2^16 permutations: interpreted %.5fs, jit %.5fs, %d deviations\n",
+	       best[0], best[1], deviations);
+}
+
+// compares RKNL with and without additional transitions on the corpus and on
+// church numerals ((n 2) I)
+static void test_optimization(struct test *tests, const char *name,
+			      unsigned optimize)
+{
+	int deviations = 0;
+	double time[2] = { 0 };
+	size_t transitions[4] = { 0 };
+
+	for (int i = 0; i < NTESTS; i++) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		ctx.optimize = optimize;
+		deviations += test_engine_term(&ctx, tests[i].in, tests[i].red,
+					       &time[0]) < 0;
+		transitions[0] += ctx.stats.transitions;
+
+		struct ctx rknl;
+		ctx_init(&rknl);
+		free_term(reduce(&rknl, tests[i].in, ignore_callback, 0));
+		transitions[1] += rknl.stats.transitions;
+	}
+
+	for (int n = 1; n <= 16; n++) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		struct term *app = new_term(APP);
+		app->u.app.lhs = new_term(APP);
+		app->u.app.lhs->u.app.lhs = church_numeral(&ctx, n);
+		app->u.app.lhs->u.app.rhs = church_numeral(&ctx, 2);
+		app->u.app.rhs = identity(&ctx);
+
+		ctx.optimize = optimize;
+		deviations += test_engine_term(&ctx, app, 0, &time[1]) < 0;
+		transitions[2] += ctx.stats.transitions;
+
+		struct ctx rknl;
+		ctx_init(&rknl);
+		free_term(reduce(&rknl, app, ignore_callback, 0));
+		transitions[3] += rknl.stats.transitions;
+		free_term(app);
+	}
+
+	printf("Test optimization %s: corpus %.5fs, %zu transitions (RKNL %zu); church %.5fs, %zu transitions (RKNL %zu); %d alpha deviations\n",
+	       name, time[0], transitions[0], transitions[1], time[1],
+	       transitions[2], transitions[3], deviations);
+}
+
+// balanced application of the variables, such that all of them are used
+static struct term *variables(int *names, int n)
+{
+	if (n == 1)
+		return variable(names[0]);
+	struct term *app = new_term(APP);
+	app->u.app.lhs = variables(names, n / 2);
+	app->u.app.rhs = variables(names + n / 2, n - n / 2);
+	return app;
+}
+
+// λh.(λa1...λan.(λu.λv.u) (h I) (a1 ... an)) I...I has the head normal form
+// λh.h I, whose unforced thunk I is created in the store of all ai
+static struct term *unforced_thunk(struct ctx *ctx, int n)
+{
+	int *names = malloc(n * sizeof(*names));
+	struct term *abs = new_term(ABS);
+	abs->u.abs.name = ctx_name(ctx);
+
+	struct term *body = new_term(APP);
+	body->u.app.lhs = new_term(APP);
+	body->u.app.lhs->u.app.lhs = new_term(ABS);
+	struct term *k = body->u.app.lhs->u.app.lhs;
+	k->u.abs.name = ctx_name(ctx);
+	k->u.abs.term = new_term(ABS);
+	k->u.abs.term->u.abs.name = ctx_name(ctx);
+	k->u.abs.term->u.abs.term = variable(k->u.abs.name);
+	body->u.app.lhs->u.app.rhs = new_term(APP);
+	body->u.app.lhs->u.app.rhs->u.app.lhs = variable(abs->u.abs.name);
+	body->u.app.lhs->u.app.rhs->u.app.rhs = identity(ctx);
+	for (int i = 0; i < n; i++)
+		names[i] = ctx_name(ctx);
+	body->u.app.rhs = variables(names, n);
+
+	for (int i = n - 1; i >= 0; i--) {
+		struct term *binder = new_term(ABS);
+		binder->u.abs.name = names[i];
+		binder->u.abs.term = body;
+		body = binder;
+	}
+	for (int i = 0; i < n; i++) {
+		struct term *app = new_term(APP);
+		app->u.app.lhs = body;
+		app->u.app.rhs = identity(ctx);
+		body = app;
+	}
+	abs->u.abs.term = body;
+	free(names);
+	return abs;
+}
+
+// bytes that the head normal form keeps reachable
+static size_t retained(struct term *term, unsigned optimize)
+{
+	struct ctx ctx;
+	ctx_init(&ctx);
+	ctx.form = HEAD_NORMAL_FORM;
+	ctx.optimize = optimize;
+
+	GC_gcollect();
+	size_t before = GC_get_heap_size() - GC_get_free_bytes();
+	struct term *res = reduce(&ctx, term, ignore_callback, 0);
+	GC_gcollect();
+	size_t after = GC_get_heap_size() - GC_get_free_bytes();
+
+	// the result stays reachable until here
+	if (!res || res->type != ABS)
+		return SIZE_MAX;
+	free_term(res);
+	return after > before ? after - before : 0;
+}
+
+// the store of a long-lived thunk must not keep the bindings it can't reach
+static void test_trim(void)
+{
+	const int n = 1 << 12;
+
+	clock_t begin = clock();
+	struct ctx ctx;
+	ctx_init(&ctx);
+	struct term *term = unforced_thunk(&ctx, n);
+	size_t whole = retained(term, 0);
+	size_t trimmed = retained(term, TRIM);
+	free_term(term);
+	clock_t end = clock();
+
+	int deviations = whole == SIZE_MAX || trimmed == SIZE_MAX ||
+			 2 * trimmed > whole;
+	printf("Test trim of an unforced thunk with %d bindings: %.5fs, %zu bytes retained (%zu untrimmed), %d deviations\n",
+	       n, (double)(end - begin) / CLOCKS_PER_SEC, trimmed, whole,
+	       deviations);
+}
+
+// the corpus as lazy normal forms, and a bounded prefix of a huge one
+static void test_lazy(struct test *tests)
+{
+	int deviations = 0;
+
+	clock_t begin = clock();
+	for (int i = 0; i < NTESTS; i++) {
+		struct ctx ctx;
+		ctx_init(&ctx);
+		struct term *res =
+			lazy_normalize(lazy_new(&ctx, tests[i].in));
+		to_bruijn(res);
+		deviations += !alpha_equivalency(res, tests[i].red);
+		free_term(res);
+	}
+
+	// λx.((n ω) x) has 2^n applications in its normal form
+	struct ctx ctx;
+	ctx_init(&ctx);
+	struct term *abs = new_term(ABS);
+	abs->u.abs.name = ctx_name(&ctx);
+	abs->u.abs.term = new_term(APP);
+	abs->u.abs.term->u.app.lhs = new_term(APP);
+	abs->u.abs.term->u.app.lhs->u.app.lhs = church_numeral(&ctx, 24);
+	abs->u.abs.term->u.app.lhs->u.app.rhs = omega(&ctx);
+	abs->u.abs.term->u.app.rhs = new_term(VAR);
+	abs->u.abs.term->u.app.rhs->u.var.name = abs->u.abs.name;
+	abs->u.abs.term->u.app.rhs->u.var.type = BARENDREGT_VARIABLE;
+	// the body is x N_0 .. N_23 with N_i = x N_0 .. N_i-1
+	struct lazy *lazy = lazy_new(&ctx, abs);
+	int x = lazy_name(lazy);
+	lazy = lazy_body(lazy);
+	for (size_t n = 24; n; n--) {
+		if (lazy_type(lazy) != VAR || lazy_name(lazy) != x ||
+		    lazy_arity(lazy) != n) {
+			deviations++;
+			break;
+		}
+		lazy = lazy_argument(lazy, n - 1);
+	}
+	deviations += lazy_arity(lazy) || ctx.stats.transitions > 1 << 12;
+	free_term(abs);
+	clock_t end = clock();
+
+	printf("Test lazy normal forms: %.5fs, %d deviations\n",
+	       (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
+// the corpus in steps, with all reductions in flight at the same time
+static void test_stepwise(struct test *tests)
+{
+	int deviations = 0;
+
+	struct ctx ctxs[NTESTS];
+	struct test copies[NTESTS];
+	struct reduction *reductions[NTESTS];
+	for (int i = 0; i < NTESTS; i++) {
+		ctx_init(&ctxs[i]);
+		copies[i] = tests[i];
+		copies[i].equivalency.trans = 1;
+		reductions[i] = reduce_start(&ctxs[i], tests[i].in, callback,
+					     &copies[i]);
+	}
+
+	clock_t begin = clock();
+	int done = 0;
+	while (done < NTESTS) {
+		done = 0;
+		for (int i = 0; i < NTESTS; i++)
+			done += reduce_run(reductions[i], 7);
+	}
+	clock_t end = clock();
+
+	for (int i = 0; i < NTESTS; i++) {
+		struct term *res = reduce_finish(reductions[i]);
+		to_bruijn(res);
+		if (!alpha_equivalency(res, tests[i].red) ||
+		    !copies[i].equivalency.trans)
+			deviations++;
+		free_term(res);
+	}
+
+	// unfinished reductions are cancelled
+	struct ctx ctx;
+	ctx_init(&ctx);
+	struct term *app = new_term(APP);
+	app->u.app.lhs = omega(&ctx);
+	app->u.app.rhs = omega(&ctx);
+	struct reduction *reduction =
+		reduce_start(&ctx, app, ignore_callback, 0);
+	deviations += reduce_run(reduction, 1000);
+	deviations += reduce_finish(reduction) != 0;
+	deviations += ctx.exceeded != CANCELLED;
+	deviations += ctx.stats.transitions != 1000;
+	free_term(app);
+
+	printf("Test stepwise corpus: %.5fs, %d deviations\n",
+	       (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
+// the corpus again, resumed from checkpoints taken after some transitions
+static void test_checkpoint(struct test *tests)
+{
+	int deviations = 0;
+
+	clock_t begin = clock();
+	for (int i = 0; i < NTESTS; i++) {
+		struct test copy = tests[i];
+		copy.equivalency.trans = 1;
+
+		struct ctx ctx;
+		ctx_init(&ctx);
+		struct reduction *reduction =
+			reduce_start(&ctx, tests[i].in, callback, &copy);
+		reduce_run(reduction, 10 * (i + 1));
+
+		FILE *file = tmpfile();
+		if (!file || reduce_checkpoint(reduction, file)) {
+			deviations++;
+			continue;
+		}
+		rewind(file);
+
+		struct ctx restored;
+		ctx_init(&restored);
+		struct reduction *resumed =
+			reduce_restore(&restored, file, callback, &copy);
+		fclose(file);
+		if (!resumed) {
+			deviations++;
+			continue;
+		}
+
+		reduce_run(resumed, SIZE_MAX);
+		struct term *res = reduce_finish(resumed);
+		to_bruijn(res);
+		deviations += !alpha_equivalency(res, tests[i].red) ||
+			      !copy.equivalency.trans;
+		free_term(res);
+
+		// the original reduction isn't affected
+		reduce_run(reduction, SIZE_MAX);
+		res = reduce_finish(reduction);
+		to_bruijn(res);
+		deviations += !alpha_equivalency(res, tests[i].red) ||
+			      !copy.equivalency.trans;
+		deviations += ctx.stats.transitions !=
+			      restored.stats.transitions;
+		free_term(res);
+	}
+
+	// a body far too deep for walking the configuration recursively
+	struct ctx ctx;
+	ctx_init(&ctx);
+	struct term *app = new_term(APP);
+	app->u.app.lhs = identity(&ctx);
+	app->u.app.rhs = identity(&ctx);
+	struct term *body = app->u.app.rhs->u.abs.term;
+	for (int n = 0; n < 1 << 20; n++)
+		body = church_numeral_builder(body,
+					      app->u.app.rhs->u.abs.name);
+	app->u.app.rhs->u.abs.term = body;
+	struct reduction *reduction =
+		reduce_start(&ctx, app, ignore_callback, 0);
+	reduce_run(reduction, 3);
+	FILE *file = tmpfile();
+	if (!file || reduce_checkpoint(reduction, file)) {
+		deviations++;
+	} else {
+		rewind(file);
+		struct ctx restored;
+		ctx_init(&restored);
+		deviations += !reduce_restore(&restored, file, ignore_callback,
+					      0);
+	}
+	if (file)
+		fclose(file);
+	clock_t end = clock();
+
+	printf("Test checkpointed corpus: %.5fs, %d deviations\n",
+	       (double)(end - begin) / CLOCKS_PER_SEC, deviations);
+}
+
 int main(void)
 {
 	GC_INIT();
@@ -239,7 +1083,9 @@ int main(void)
 
 	clock_t begin = clock();
 	for (int i = 0; i < NTESTS; i++) {
-		tests[i].res = reduce(tests[i].in, callback, &tests[i]);
+		struct ctx ctx;
+		ctx_init(&ctx);
+		tests[i].res = reduce(&ctx, tests[i].in, callback, &tests[i]);
 		printf("Test %d done\n", i + 1 + STARTTEST);
 	}
 	clock_t end = clock();
@@ -249,8 +1095,6 @@ int main(void)
 		tests[i].equivalency.alpha =
 			alpha_equivalency(tests[i].res, tests[i].red);
 		free_term(tests[i].res);
-		free_term(tests[i].red);
-		free(tests[i].trans);
 	}
 
 	printf("\n=== REDUCTION SUMMARY ===\n");
@@ -266,7 +1110,49 @@ int main(void)
 
 	printf("\n=== OTHER TESTS ===\n");
 	test_church_transitions();
+	test_concurrent_church_transitions();
 	test_explode();
+	test_sharing_equality();
+	test_budget();
+	test_stepwise(tests);
+	test_checkpoint(tests);
+	test_head_forms(tests);
+	test_lazy(tests);
+	test_engine(tests, "fireball", FIREBALL, 0);
+	test_engine(tests, "crumbling", CRUMBLING, 0);
+	test_engine(tests, "net", INTERACTION, 0);
+	test_engine(tests, "vm", BYTECODE, 0);
+	test_engine(tests, "vm, jit", BYTECODE, 2);
+	test_jit();
+	test_engine(tests, "lift", SUPERCOMBINATOR, 0);
+	test_optimization(tests, "nary", NARY_BETA);
+	test_optimization(tests, "fuse", FUSED);
+	test_optimization(tests, "nary, fuse", NARY_BETA | FUSED);
+	test_optimization(tests, "atomic", ATOMIC);
+	test_optimization(tests, "trim", TRIM);
+	test_optimization(tests, "linear", LINEAR);
+	test_optimization(tests, "all", ~0u);
+	test_trim();
+
+	struct ctx parallel;
+	ctx_init(&parallel);
+	parallel.pool = pool_new(4);
+	test_corpus(tests, "parallel", &parallel);
+	parallel.speculate = 1 << 12;
+	test_corpus(tests, "parallel, speculative", &parallel);
+	parallel.engine = INTERACTION;
+	parallel.speculate = 0;
+	test_corpus(tests, "parallel, net", &parallel);
+	parallel.speculate = 1 << 20;
+	test_corpus(tests, "parallel, speculative net", &parallel);
+	pool_destroy(parallel.pool);
+	test_remote(tests);
+
+	for (int i = 0; i < NTESTS; i++) {
+		free_term(tests[i].in);
+		free_term(tests[i].red);
+		free(tests[i].trans);
+	}
 }
 #else
 __attribute__((unused)) static int no_testing;
@@ -0,0 +1,137 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// counts the n-grams of transition traces in one hash table per length,
+// sequences are packed into integers of 5 bits per transition
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <trace.h>
+#include <ctx.h>
+
+#define TRACE_MAX 12
+
+struct gram {
+	uint64_t key; // 0 if the slot is empty
+	size_t count;
+};
+
+struct table {
+	struct gram *grams;
+	size_t size, used;
+};
+
+struct trace {
+	size_t length;
+	struct table tables[TRACE_MAX + 1];
+};
+
+// transitions are 1-9 and A-V such that their codes fit into 5 bits,
+// anything else ends a trace
+static int transition_code(char ch)
+{
+	if (ch >= '1' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'A' && ch <= 'V')
+		return ch - 'A' + 10;
+	return 0;
+}
+
+static char transition_char(int code)
+{
+	return code < 10 ? '0' + code : 'A' + code - 10;
+}
+
+static struct gram *table_find(struct table *table, uint64_t key)
+{
+	size_t i = (key * 0x9e3779b97f4a7c15u) >> 32;
+	while (1) {
+		struct gram *gram = &table->grams[i & (table->size - 1)];
+		if (!gram->key || gram->key == key)
+			return gram;
+		i++;
+	}
+}
+
+static void table_count(struct table *table, uint64_t key)
+{
+	if (2 * (table->used + 1) > table->size) {
+		struct table grown = { 0, table->size ? table->size * 2 : 256,
+				       table->used };
+		grown.grams = xcalloc(grown.size, sizeof(*grown.grams));
+		for (size_t i = 0; i < table->size; i++)
+			if (table->grams[i].key)
+				*table_find(&grown, table->grams[i].key) =
+					table->grams[i];
+		free(table->grams);
+		*table = grown;
+	}
+
+	struct gram *gram = table_find(table, key);
+	if (!gram->key) {
+		gram->key = key;
+		table->used++;
+	}
+	gram->count++;
+}
+
+struct trace *trace_new(size_t length)
+{
+	struct trace *trace = xcalloc(1, sizeof(*trace));
+	trace->length = length < 2 ? 2 : length > TRACE_MAX ? TRACE_MAX : length;
+	return trace;
+}
+
+void trace_add(struct trace *trace, const char *transitions)
+{
+	size_t count = 0;
+	uint64_t window = 0; // the last transitions, newest in the lowest bits
+	for (; transition_code(*transitions); transitions++) {
+		window = (window << 5) | transition_code(*transitions);
+		count++;
+		for (size_t n = 2; n <= trace->length && n <= count; n++)
+			table_count(&trace->tables[n],
+				    window & ((UINT64_C(1) << (5 * n)) - 1));
+	}
+}
+
+static int gram_compare(const void *a, const void *b)
+{
+	const struct gram *x = a, *y = b;
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+void trace_print(struct trace *trace, FILE *out, size_t top)
+{
+	for (size_t n = 2; n <= trace->length; n++) {
+		struct table *table = &trace->tables[n];
+		struct gram *grams = xcalloc(table->used + 1, sizeof(*grams));
+		size_t used = 0;
+		for (size_t i = 0; i < table->size; i++)
+			if (table->grams[i].key)
+				grams[used++] = table->grams[i];
+		qsort(grams, used, sizeof(*grams), gram_compare);
+
+		for (size_t i = 0; i < top && i < used; i++) {
+			char sequence[TRACE_MAX + 1];
+			for (size_t j = 0; j < n; j++)
+				sequence[j] = transition_char(
+					(grams[i].key >> (5 * (n - 1 - j))) &
+					31);
+			sequence[n] = 0;
+			fprintf(out, "%s\t%zu\n", sequence, grams[i].count);
+		}
+		free(grams);
+		if (n < trace->length)
+			fprintf(out, "\n");
+	}
+}
+
+void trace_free(struct trace *trace)
+{
+	for (size_t n = 0; n <= TRACE_MAX; n++)
+		free(trace->tables[n].grams);
+	free(trace);
+}
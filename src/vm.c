@@ -0,0 +1,624 @@
+// Copyright (c) 2023, Marvin Borner <dev@marvinborner.de>
+// bytecode: terms are compiled to a flat array of instructions of a lazy
+// krivine machine, where every variable is accessed by its precomputed slot
+// in the environment -- arguments are pushed as thunks and updated with
+// their values, so they are evaluated at most once, bodies of abstractions
+// and arguments of neutral terms are evaluated on read back
+// hot abstraction bodies are compiled to native code on x86-64 linux
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT
+#endif
+
+#include <vm.h>
+#include <gc.h>
+
+// instructions with their operands, sequences of PUSH and GRAB end with an
+// ACCESS or FREE
+enum instruction {
+	GRAB, // binds the top argument or returns the abstraction
+	PUSH, // pushes a thunk of the code at the operand
+	ACCESS, // enters the thunk at the operand in the environment
+	FREE, // returns the variable with the operand as name
+};
+
+struct code {
+	int *words;
+	int count, size;
+};
+
+struct env {
+	struct thunk *thunk;
+	struct env *next;
+};
+
+struct value {
+	enum { LAMBDA, VARIABLE, NEUTRAL } type;
+	union {
+		struct {
+			int pc; // of a GRAB
+			struct env *env;
+		} closure;
+		int name;
+		struct {
+			struct value *fun; // variable or neutral
+			struct thunk *arg;
+		} neutral;
+	} u;
+	struct term *normal; // memoized read back, see copy_term
+};
+
+struct thunk {
+	int pc;
+	struct env *env;
+	struct value *value; // after the first evaluation
+};
+
+// thunks are updated when the stack shrinks back to their mark
+struct mark {
+	struct thunk *thunk;
+	size_t height;
+};
+
+struct machine;
+
+// runs the GRAB and PUSH instructions of a sequence, returns the pc of the
+// ACCESS or FREE at its end or its own pc if a GRAB would lack an argument
+typedef int (*native)(struct machine *machine, struct env **env,
+		      size_t height);
+
+// per abstraction body, the native code is mapped separately
+struct hot {
+	int count; // applications, -1 if it can't be compiled
+	int steps; // instructions until the end of the sequence
+	native code;
+	void *map;
+	size_t size;
+};
+
+struct machine {
+	struct ctx *ctx;
+	void (*callback)(int, char, void *);
+	void *data;
+	int i;
+	struct code code;
+	struct hot *hot; // per pc if ctx->jit is set
+	struct thunk **stack; // visible to the garbage collector
+	size_t sp, size;
+	struct mark *marks;
+	size_t mp, marks_size;
+};
+
+static int emit(struct code *code, int word)
+{
+	if (code->count == code->size) {
+		code->size = code->size ? code->size * 2 : 256;
+		code->words = xrealloc(code->words,
+				       code->size * sizeof(*code->words));
+	}
+	code->words[code->count] = word;
+	return code->count++;
+}
+
+// the arguments of a sequence are compiled after it, in the environment of
+// their PUSH, which is a prefix of the environment at the end
+static void compile(struct code *code, struct term *term, const int *names,
+		    int depth)
+{
+	int size = depth + 16;
+	int *env = xrealloc(0, size * sizeof(*env));
+	if (depth)
+		memcpy(env, names, depth * sizeof(*env));
+
+	struct pending {
+		struct term *term;
+		int patch;
+		int depth;
+	} *args = 0;
+	int count = 0;
+
+	while (1) {
+		if (term->type == ABS) {
+			emit(code, GRAB);
+			if (depth == size) {
+				size *= 2;
+				env = xrealloc(env, size * sizeof(*env));
+			}
+			env[depth++] = term->u.abs.name;
+			term = term->u.abs.term;
+		} else if (term->type == APP) {
+			emit(code, PUSH);
+			args = xrealloc(args, (count + 1) * sizeof(*args));
+			args[count++] = (struct pending){ term->u.app.rhs,
+							  emit(code, 0), depth };
+			term = term->u.app.lhs;
+		} else if (term->type == VAR) {
+			int slot = depth - 1;
+			while (slot >= 0 && env[slot] != term->u.var.name)
+				slot--;
+			if (slot < 0) {
+				emit(code, FREE);
+				emit(code, term->u.var.name);
+			} else {
+				emit(code, ACCESS);
+				emit(code, depth - 1 - slot);
+			}
+			break;
+		} else {
+			fprintf(stderr, "Invalid term type %d\n", term->type);
+			abort();
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		code->words[args[i].patch] = code->count;
+		compile(code, args[i].term, env, args[i].depth);
+	}
+	free(args);
+	free(env);
+}
+
+static void *grow(void *ptr, size_t *size, size_t element)
+{
+	size_t old = *size;
+	*size = old ? old * 2 : 1024;
+	void *new = GC_malloc(*size * element);
+	if (!new) {
+		fprintf(stderr, "Out of memory!\n");
+		abort();
+	}
+	if (ptr)
+		memcpy(new, ptr, old * element);
+	return new;
+}
+
+static struct value *value_new(struct ctx *ctx, int type)
+{
+	struct value *value = ctx_alloc(ctx, sizeof(*value));
+	value->type = type;
+	value->normal = 0;
+	return value;
+}
+
+static void grab(struct machine *machine, struct env **env)
+{
+	struct env *bound = ctx_alloc(machine->ctx, sizeof(*bound));
+	bound->thunk = machine->stack[--machine->sp];
+	bound->next = *env;
+	*env = bound;
+}
+
+// room for count more thunks on the stack
+static void reserve(struct machine *machine, size_t count)
+{
+	while (machine->sp + count > machine->size)
+		machine->stack = grow(machine->stack, &machine->size,
+				      sizeof(*machine->stack));
+}
+
+static void push(struct machine *machine, struct env **env, int pc)
+{
+	reserve(machine, 1);
+	struct thunk *thunk = ctx_alloc(machine->ctx, sizeof(*thunk));
+	thunk->pc = pc;
+	thunk->env = *env;
+	thunk->value = 0;
+	machine->stack[machine->sp++] = thunk;
+}
+
+#ifdef JIT
+struct assembler {
+	uint8_t *bytes;
+	size_t count, size;
+};
+
+static void assemble(struct assembler *as, const void *bytes, size_t count)
+{
+	if (as->count + count > as->size) {
+		as->size = (as->size + count) * 2;
+		as->bytes = xrealloc(as->bytes, as->size);
+	}
+	memcpy(as->bytes + as->count, bytes, count);
+	as->count += count;
+}
+
+// machine in rbx, pointer to the environment in r12 and the environment
+// itself in r14, height in r13, ctx in r15 -- sequences that run out of
+// arguments are left to the interpreter, the others allocate their bindings
+// and thunks as one block and update the stack and the environment inline
+static int jit_compile(struct machine *machine, struct hot *hot, int pc)
+{
+	const int32_t ctx = offsetof(struct machine, ctx);
+	const int32_t stack = offsetof(struct machine, stack);
+	const int32_t sp = offsetof(struct machine, sp);
+	const int32_t size = offsetof(struct machine, size);
+	uint8_t prologue[] = {
+		0x53, // push rbx
+		0x41, 0x54, // push r12
+		0x41, 0x55, // push r13
+		0x41, 0x56, // push r14
+		0x41, 0x57, // push r15, the stack is aligned for calls
+		0x48, 0x89, 0xfb, // mov rbx, rdi
+		0x49, 0x89, 0xf4, // mov r12, rsi
+		0x49, 0x89, 0xd5, // mov r13, rdx
+		0x4d, 0x8b, 0x34, 0x24, // mov r14, [r12]
+		0x4c, 0x8b, 0xbb, 0, 0, 0, 0, // mov r15, [rbx + ctx]
+	};
+	static const uint8_t epilogue[] = {
+		0x4d, 0x89, 0x34, 0x24, // mov [r12], r14
+		0x41, 0x5f, // pop r15
+		0x41, 0x5e, // pop r14
+		0x41, 0x5d, // pop r13
+		0x41, 0x5c, // pop r12
+		0x5b, // pop rbx
+		0xc3, // ret
+	};
+	memcpy(prologue + 25, &ctx, 4);
+	const int *words = machine->code.words;
+
+	// arguments the GRABs take from below the height, most thunks the
+	// PUSHes have on the stack at once and bytes of the block
+	int32_t needed = 0, pushed = 0, most = 0, bytes = 0;
+	int end = pc;
+	for (hot->steps = 0; words[end] == GRAB || words[end] == PUSH;
+	     hot->steps++) {
+		if (words[end] == GRAB && --pushed < -needed)
+			needed = -pushed;
+		if (words[end] == PUSH && ++pushed > most)
+			most = pushed;
+		bytes += words[end] == GRAB ? sizeof(struct env) :
+					      sizeof(struct thunk);
+		end += words[end] == PUSH ? 2 : 1;
+	}
+
+	struct assembler as = { 0 };
+	assemble(&as, prologue, sizeof(prologue));
+	uint8_t check[] = {
+		0x48, 0x8b, 0x83, 0, 0, 0, 0, // mov rax, sp
+		0x4c, 0x29, 0xe8, // sub rax, r13
+		0x48, 0x3d, 0, 0, 0, 0, // cmp rax, needed
+		0x73, 0x0a, // jae run
+		0xb8, 0, 0, 0, 0, // mov eax, pc
+		0xe9, 0, 0, 0, 0, // jmp epilogue
+	};
+	memcpy(check + 3, &sp, 4);
+	memcpy(check + 12, &needed, 4);
+	memcpy(check + 19, &pc, 4);
+	assemble(&as, check, sizeof(check));
+	size_t exit = as.count;
+
+	if (most > 0) {
+		void (*reserve_helper)(struct machine *, size_t) = reserve;
+		uint8_t room[] = {
+			0x48, 0x8b, 0x83, 0, 0, 0, 0, // mov rax, sp
+			0x48, 0x05, 0, 0, 0, 0, // add rax, most
+			0x48, 0x3b, 0x83, 0, 0, 0, 0, // cmp rax, size
+			0x76, 0x14, // jbe alloc
+			0x48, 0x89, 0xdf, // mov rdi, rbx
+			0xbe, 0, 0, 0, 0, // mov esi, most
+			0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov rax, reserve
+			0xff, 0xd0, // call rax
+		};
+		memcpy(room + 3, &sp, 4);
+		memcpy(room + 9, &most, 4);
+		memcpy(room + 16, &size, 4);
+		memcpy(room + 26, &most, 4);
+		memcpy(room + 32, &reserve_helper, 8);
+		assemble(&as, room, sizeof(room));
+	}
+
+	void *(*alloc_helper)(struct ctx *, size_t) = ctx_alloc;
+	uint8_t alloc[] = {
+		0x4c, 0x89, 0xff, // mov rdi, r15
+		0xbe, 0, 0, 0, 0, // mov esi, bytes
+		0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // mov rax, ctx_alloc
+		0xff, 0xd0, // call rax
+		0x48, 0x8b, 0x8b, 0, 0, 0, 0, // mov rcx, sp
+		0x48, 0x8b, 0x93, 0, 0, 0, 0, // mov rdx, stack
+	};
+	memcpy(alloc + 4, &bytes, 4);
+	memcpy(alloc + 10, &alloc_helper, 8);
+	memcpy(alloc + 23, &sp, 4);
+	memcpy(alloc + 30, &stack, 4);
+	assemble(&as, alloc, sizeof(alloc));
+
+	// the block is in rax, sp in rcx and the stack in rdx
+	for (int32_t offset = 0; pc < end;) {
+		if (words[pc] == GRAB) {
+			int32_t thunk = offset + offsetof(struct env, thunk);
+			int32_t next = offset + offsetof(struct env, next);
+			uint8_t grab[] = {
+				0x48, 0xff, 0xc9, // dec rcx
+				0x48, 0x8b, 0x34, 0xca, // mov rsi, [rdx + 8 * rcx]
+				0x48, 0x89, 0xb0, 0, 0, 0, 0, // mov thunk, rsi
+				0x4c, 0x89, 0xb0, 0, 0, 0, 0, // mov next, r14
+				0x4c, 0x8d, 0xb0, 0, 0, 0, 0, // lea r14, env
+			};
+			memcpy(grab + 10, &thunk, 4);
+			memcpy(grab + 17, &next, 4);
+			memcpy(grab + 24, &offset, 4);
+			assemble(&as, grab, sizeof(grab));
+			offset += sizeof(struct env);
+			pc++;
+		} else {
+			int32_t target = offset + offsetof(struct thunk, pc);
+			int32_t env = offset + offsetof(struct thunk, env);
+			int32_t value = offset + offsetof(struct thunk, value);
+			uint8_t push[] = {
+				0xc7, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, // mov pc
+				0x4c, 0x89, 0xb0, 0, 0, 0, 0, // mov env, r14
+				0x48, 0xc7, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, // value
+				0x48, 0x8d, 0xb0, 0, 0, 0, 0, // lea rsi, thunk
+				0x48, 0x89, 0x34, 0xca, // mov [rdx + 8 * rcx], rsi
+				0x48, 0xff, 0xc1, // inc rcx
+			};
+			memcpy(push + 2, &target, 4);
+			memcpy(push + 6, &words[pc + 1], 4);
+			memcpy(push + 13, &env, 4);
+			memcpy(push + 20, &value, 4);
+			memcpy(push + 31, &offset, 4);
+			assemble(&as, push, sizeof(push));
+			offset += sizeof(struct thunk);
+			pc += 2;
+		}
+	}
+	uint8_t done[] = {
+		0x48, 0x89, 0x8b, 0, 0, 0, 0, // mov sp, rcx
+		0xb8, 0, 0, 0, 0, // mov eax, pc
+	};
+	memcpy(done + 3, &sp, 4);
+	memcpy(done + 8, &pc, 4);
+	assemble(&as, done, sizeof(done));
+	int32_t rel = as.count - exit;
+	memcpy(as.bytes + exit - 4, &rel, 4);
+	assemble(&as, epilogue, sizeof(epilogue));
+
+	void *map = mmap(0, as.count, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		free(as.bytes);
+		return 0;
+	}
+	memcpy(map, as.bytes, as.count);
+	free(as.bytes);
+	if (mprotect(map, as.count, PROT_READ | PROT_EXEC)) {
+		munmap(map, as.count);
+		return 0;
+	}
+	hot->map = map;
+	hot->size = as.count;
+	memcpy(&hot->code, &map, sizeof(map));
+	return 1;
+}
+#endif
+
+// abstraction bodies are compiled after ctx->jit applications, returns the
+// pc where the interpreter continues
+static int jit(struct machine *machine, int pc, struct env **env,
+	       size_t height)
+{
+	struct ctx *ctx = machine->ctx;
+	struct hot *hot = &machine->hot[pc];
+	if (!hot->code) {
+		if (hot->count < 0 || (size_t)++hot->count < ctx->jit)
+			return pc;
+#ifdef JIT
+		if (jit_compile(machine, hot, pc))
+			ctx->stats.compiled++;
+		else
+#endif
+		{
+			hot->count = -1;
+			return pc;
+		}
+	}
+	if (ctx->fuel < (size_t)hot->steps)
+		return pc;
+
+	int end = hot->code(machine, env, height);
+	const int *words = machine->code.words;
+	for (; pc < end; pc += words[pc] == PUSH ? 2 : 1) {
+		machine->callback(machine->i++, words[pc] == PUSH ? 'p' : 'g',
+				  machine->data);
+		ctx->fuel--;
+		ctx->stats.transitions++;
+	}
+	return end;
+}
+
+// runs the code with the arguments above base on the stack, returns 0 if the
+// budget is exceeded
+static struct value *run(struct machine *machine, int pc, struct env *env,
+			 size_t base)
+{
+	struct ctx *ctx = machine->ctx;
+	const int *words = machine->code.words;
+	size_t bottom = machine->mp;
+	struct value *value = 0;
+	while (1) {
+		if (!ctx->fuel && ctx_check(ctx))
+			break;
+		ctx->fuel--;
+		ctx->stats.transitions++;
+
+		size_t height = machine->mp > bottom ?
+					machine->marks[machine->mp - 1].height :
+					base;
+		if (value) { // apply to the arguments above the last mark
+			if (machine->sp == height) {
+				if (machine->mp == bottom)
+					break;
+				machine->callback(machine->i++, 'u',
+						  machine->data);
+				machine->marks[--machine->mp].thunk->value =
+					value;
+			} else if (value->type == LAMBDA) {
+				machine->callback(machine->i++, 'c',
+						  machine->data);
+				pc = value->u.closure.pc;
+				env = value->u.closure.env;
+				value = 0;
+				if (machine->hot)
+					pc = jit(machine, pc, &env, height);
+			} else {
+				machine->callback(machine->i++, 'n',
+						  machine->data);
+				struct value *neutral = value_new(ctx, NEUTRAL);
+				neutral->u.neutral.fun = value;
+				neutral->u.neutral.arg =
+					machine->stack[--machine->sp];
+				value = neutral;
+			}
+			continue;
+		}
+
+		switch (words[pc]) {
+		case GRAB:
+			machine->callback(machine->i++, 'g', machine->data);
+			if (machine->sp == height) {
+				value = value_new(ctx, LAMBDA);
+				value->u.closure.pc = pc;
+				value->u.closure.env = env;
+				break;
+			}
+			grab(machine, &env);
+			pc++;
+			break;
+		case PUSH:
+			machine->callback(machine->i++, 'p', machine->data);
+			push(machine, &env, words[pc + 1]);
+			pc += 2;
+			break;
+		case ACCESS:
+			machine->callback(machine->i++, 'a', machine->data);
+			for (int n = words[pc + 1]; n; n--)
+				env = env->next;
+			struct thunk *thunk = env->thunk;
+			if (thunk->value) {
+				value = thunk->value;
+				break;
+			}
+			if (machine->mp == machine->marks_size)
+				machine->marks = grow(machine->marks,
+						      &machine->marks_size,
+						      sizeof(*machine->marks));
+			machine->marks[machine->mp++] =
+				(struct mark){ thunk, machine->sp };
+			pc = thunk->pc;
+			env = thunk->env;
+			break;
+		case FREE:
+			machine->callback(machine->i++, 'f', machine->data);
+			value = value_new(ctx, VARIABLE);
+			value->u.name = words[pc + 1];
+			break;
+		default:
+			fprintf(stderr, "Invalid instruction %d\n", words[pc]);
+			abort();
+		}
+	}
+
+	machine->mp = bottom; // if the budget is exceeded
+	return ctx_exceeded(ctx) ? 0 : value;
+}
+
+static struct value *force(struct machine *machine, struct thunk *thunk)
+{
+	if (thunk->value)
+		return thunk->value;
+	size_t sp = machine->sp;
+	struct value *value = run(machine, thunk->pc, thunk->env, sp);
+	machine->sp = sp;
+	thunk->value = value;
+	return value;
+}
+
+static struct term *read_back(struct machine *machine, struct value *value)
+{
+	struct ctx *ctx = machine->ctx;
+	if (!value)
+		return 0;
+	if (value->normal)
+		return copy_term(ctx, value->normal);
+
+	struct term *term = 0;
+	switch (value->type) {
+	case LAMBDA:;
+		int x = ctx_name(ctx);
+		struct thunk *var = ctx_alloc(ctx, sizeof(*var));
+		var->value = value_new(ctx, VARIABLE);
+		var->value->u.name = x;
+		size_t sp = machine->sp;
+		if (sp == machine->size)
+			machine->stack = grow(machine->stack, &machine->size,
+					      sizeof(*machine->stack));
+		machine->stack[machine->sp++] = var;
+		struct value *body = run(machine, value->u.closure.pc,
+					 value->u.closure.env, sp);
+		machine->sp = sp;
+		struct term *normal = read_back(machine, body);
+		if (!normal)
+			return 0;
+		term = output_term(ctx, ABS);
+		term->u.abs.name = x;
+		term->u.abs.term = normal;
+		break;
+	case VARIABLE:
+		term = output_term(ctx, VAR);
+		term->u.var.name = value->u.name;
+		term->u.var.type = BARENDREGT_VARIABLE;
+		return term;
+	case NEUTRAL:;
+		struct term *lhs = read_back(machine, value->u.neutral.fun);
+		struct term *rhs =
+			lhs ? read_back(machine,
+					force(machine, value->u.neutral.arg)) :
+			      0;
+		if (!rhs)
+			return 0;
+		term = output_term(ctx, APP);
+		term->u.app.lhs = lhs;
+		term->u.app.rhs = rhs;
+		break;
+	default:
+		fprintf(stderr, "Invalid value type %d\n", value->type);
+		return 0;
+	}
+	value->normal = term;
+	return term;
+}
+
+// returns 0 if the budget is exceeded, ctx->exceeded tells which limit
+struct term *vm(struct ctx *ctx, struct term *term,
+		void (*callback)(int, char, void *), void *data)
+{
+	ctx_start(ctx);
+	struct machine machine = { 0 };
+	machine.ctx = ctx;
+	machine.callback = callback;
+	machine.data = data;
+	compile(&machine.code, term, 0, 0);
+	if (ctx->jit)
+		machine.hot =
+			xrealloc(0, machine.code.count * sizeof(*machine.hot));
+	if (machine.hot)
+		memset(machine.hot, 0,
+		       machine.code.count * sizeof(*machine.hot));
+
+	struct term *res = read_back(&machine, run(&machine, 0, 0, 0));
+#ifdef JIT
+	for (int pc = 0; machine.hot && pc < machine.code.count; pc++)
+		if (machine.hot[pc].map)
+			munmap(machine.hot[pc].map, machine.hot[pc].size);
+#endif
+	free(machine.hot);
+	free(machine.code.words);
+	return res;
+}